@@ -4,16 +4,23 @@
 #ifndef BASE_HPP
 #define BASE_HPP
 
+#include"base/bvh.hpp"
 #include"base/ray.hpp"
 #include"base/rng.hpp"
+#include"base/aabb.hpp"
 #include"base/math.hpp"
+#include"base/simd.hpp"
 #include"base/scene.hpp"
 #include"base/image.hpp"
 #include"base/sphere.hpp"
 #include"base/object.hpp"
 #include"base/camera.hpp"
 #include"base/kd_tree.hpp"
+#include"base/hash_grid.hpp"
+#include"base/tonemap.hpp"
 #include"base/parallel.hpp"
+#include"base/splat_buffer.hpp"
+#include"base/sphere_array.hpp"
 #include"base/distribution.hpp"
 #include"base/intersection.hpp"
 #include"base/material.hpp"
@@ -0,0 +1,100 @@
+#pragma once
+
+#ifndef AABB_HPP
+#define AABB_HPP
+
+#include<algorithm>
+
+#include"math.hpp"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//aabb
+/*/////////////////////////////////////////////////////////////////////////////////////////////////
+axis aligned bounding box
+/////////////////////////////////////////////////////////////////////////////////////////////////*/
+
+class aabb
+{
+public:
+
+	//constructors (default constructor makes empty box)
+	aabb() : m_min(FLT_MAX), m_max(-FLT_MAX)
+	{
+	}
+	aabb(const vec3 &min, const vec3 &max) : m_min(min), m_max(max)
+	{
+	}
+
+	//expand box to contain point p / box b
+	void expand(const vec3 &p)
+	{
+		for(int k = 0; k < 3; k++){
+			m_min[k] = std::min(m_min[k], p[k]);
+			m_max[k] = std::max(m_max[k], p[k]);
+		}
+	}
+	void expand(const aabb &b)
+	{
+		for(int k = 0; k < 3; k++){
+			m_min[k] = std::min(m_min[k], b.m_min[k]);
+			m_max[k] = std::max(m_max[k], b.m_max[k]);
+		}
+	}
+
+	const vec3 &min() const
+	{
+		return m_min;
+	}
+	const vec3 &max() const
+	{
+		return m_max;
+	}
+
+	vec3 center() const
+	{
+		return (m_min + m_max) * 0.5f;
+	}
+
+	//return axis of the longest extent
+	int max_extent_axis() const
+	{
+		const vec3 e = m_max - m_min;
+		return (e.x > e.y) ? ((e.x > e.z) ? 0 : 2) : ((e.y > e.z) ? 1 : 2);
+	}
+
+	float surface_area() const
+	{
+		const vec3 e = m_max - m_min;
+		return is_empty() ? 0 : 2 * (e.x * e.y + e.y * e.z + e.z * e.x);
+	}
+
+	bool is_empty() const
+	{
+		return (m_min.x > m_max.x) || (m_min.y > m_max.y) || (m_min.z > m_max.z);
+	}
+
+	//slab test of ray (o, 1/d) against box within [t_min,t_max]
+	//if ray intersects box, entry distance is stored in t_near
+	bool intersect(const vec3 &o, const vec3 &inv_d, const float t_min, const float t_max, float &t_near) const
+	{
+		float t0 = t_min;
+		float t1 = t_max;
+		for(int k = 0; k < 3; k++){
+			const float tk0 = (m_min[k] - o[k]) * inv_d[k];
+			const float tk1 = (m_max[k] - o[k]) * inv_d[k];
+			t0 = std::max(t0, std::min(tk0, tk1));
+			t1 = std::min(t1, std::max(tk0, tk1));
+		}
+		t_near = t0;
+		return (t0 <= t1);
+	}
+
+private:
+
+	vec3 m_min;
+	vec3 m_max;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif
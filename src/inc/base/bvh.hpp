@@ -0,0 +1,325 @@
+#pragma once
+
+#ifndef BVH_HPP
+#define BVH_HPP
+
+#include<vector>
+#include<cstdint>
+#include<algorithm>
+
+#include"ray.hpp"
+#include"aabb.hpp"
+#include"simd.hpp"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//bvh
+/*/////////////////////////////////////////////////////////////////////////////////////////////////
+bounding volume hierarchy built with binned SAH
+nodes are stored in depth-first order (left child of node i is i+1)
+leaves refer to ranges of the primitive order returned by bvh::indices()
+intersection with primitives in each leaf is evaluated by callback
+/////////////////////////////////////////////////////////////////////////////////////////////////*/
+
+class bvh
+{
+public:
+
+	struct node{
+		aabb box;
+		uint32_t offset; //index of first primitive (leaf) or index of right child (inner node)
+		uint16_t count;  //number of primitives (0 for inner node)
+		uint16_t axis;   //split axis
+	};
+
+	//bounds: bounding boxes of primitives, max_leaf_size: maximum number of primitives in leaf
+	//primitive_cost: cost of testing a primitive in leaf relative to node traversal (e.g., 1/width if primitives in leaf are tested by SIMD)
+	explicit bvh(const std::vector<aabb> &bounds, const size_t max_leaf_size = 4, const float primitive_cost = 1) : m_indices(bounds.size())
+	{
+		if(bounds.empty()){
+			return;
+		}
+
+		std::vector<vec3> centers(bounds.size());
+		for(size_t i = 0, n = bounds.size(); i < n; i++){
+			m_indices[i] = uint32_t(i); centers[i] = bounds[i].center();
+		}
+		m_nodes.reserve(2 * bounds.size());
+
+		auto implement = [&](const size_t first, const size_t last, const size_t depth, auto *This) -> void
+		{
+			const size_t idx = m_nodes.size();
+			m_nodes.emplace_back();
+
+			aabb box, c_box;
+			for(size_t i = first; i < last; i++){
+				box.expand(bounds[m_indices[i]]); c_box.expand(centers[m_indices[i]]);
+			}
+			m_nodes[idx].box = box;
+
+			auto make_leaf = [&](){
+				m_nodes[idx].offset = uint32_t(first); m_nodes[idx].count = uint16_t(last - first); m_nodes[idx].axis = 0;
+			};
+
+			const size_t num = last - first;
+			if(num <= min_leaf_size){
+				make_leaf(); return;
+			}
+
+			const int k = c_box.max_extent_axis();
+			const float c_min = c_box.min()[k];
+			const float c_ext = c_box.max()[k] - c_min;
+
+			size_t mid;
+			if(c_ext <= 0){
+				//all centers coincide. split by count
+				if(num <= max_leaf_size){
+					make_leaf(); return;
+				}
+				mid = first + num / 2;
+			}else{
+				//bin primitives by center
+				aabb bin_box[num_bins];
+				size_t bin_count[num_bins] = {};
+				auto bin_of = [&](const uint32_t i){
+					return std::min(int(num_bins * (centers[i][k] - c_min) / c_ext), int(num_bins) - 1);
+				};
+				for(size_t i = first; i < last; i++){
+					const int b = bin_of(m_indices[i]);
+					bin_box[b].expand(bounds[m_indices[i]]); bin_count[b]++;
+				}
+
+				//sweep from right to accumulate cost of right side
+				float r_cost[num_bins];
+				{
+					aabb r_box; size_t r_count = 0;
+					for(size_t b = num_bins - 1; b > 0; b--){
+						r_box.expand(bin_box[b]); r_count += bin_count[b];
+						r_cost[b] = r_box.surface_area() * r_count;
+					}
+				}
+
+				//sweep from left to find split with minimum SAH cost
+				size_t best_split = 0;
+				float best_cost = FLT_MAX;
+				{
+					aabb l_box; size_t l_count = 0;
+					for(size_t b = 0; b + 1 < num_bins; b++){
+						l_box.expand(bin_box[b]); l_count += bin_count[b];
+						const float cost = l_box.surface_area() * l_count + r_cost[b + 1];
+						if(l_count > 0 && l_count < num && cost < best_cost){
+							best_cost = cost; best_split = b + 1;
+						}
+					}
+				}
+				best_cost = traversal_cost + primitive_cost * best_cost / box.surface_area();
+
+				//leaf is made if SAH cost of split is not less than cost of leaf (primitive_cost*num)
+				//median split for deep nodes bounds the depth of tree by max_depth
+				if(best_split == 0 || (num <= max_leaf_size && best_cost >= primitive_cost * num) || (depth >= max_depth / 2)){
+					if(num <= max_leaf_size){
+						make_leaf(); return;
+					}
+					mid = first + num / 2;
+					std::nth_element(m_indices.begin() + first, m_indices.begin() + mid, m_indices.begin() + last, [&](const uint32_t a, const uint32_t b){
+						return (centers[a][k] < centers[b][k]);
+					});
+				}else{
+					mid = std::partition(m_indices.begin() + first, m_indices.begin() + last, [&](const uint32_t i){
+						return (size_t(bin_of(i)) < best_split);
+					}) - m_indices.begin();
+				}
+			}
+
+			m_nodes[idx].count = 0;
+			m_nodes[idx].axis = uint16_t(k);
+			(*This)(first, mid, depth + 1, This);
+			m_nodes[idx].offset = uint32_t(m_nodes.size());
+			(*This)(mid, last, depth + 1, This);
+		};
+		implement(0, bounds.size(), 0, &implement);
+		m_nodes.shrink_to_fit();
+	}
+	bvh() = default;
+
+	//closest hit traversal
+	//func(first, last, r) intersects r with primitives [first,last) and shortens r.t() if they intersect
+	template<class Func> void traverse(ray &r, Func func) const
+	{
+		if(m_nodes.empty()){
+			return;
+		}
+
+		const vec3 inv_d(1 / r.d().x, 1 / r.d().y, 1 / r.d().z);
+
+		float t_near;
+		if(m_nodes[0].box.intersect(r.o(), inv_d, r.t_min(), r.t(), t_near) == false){
+			return;
+		}
+
+		struct entry{
+			uint32_t idx; float t_near;
+		};
+		entry stack[max_depth];
+		int top = 0;
+		stack[top++] = entry{ 0, t_near };
+
+		while(top > 0){
+
+			const entry e = stack[--top];
+			if(e.t_near > r.t()){
+				continue;
+			}
+			const node &node = m_nodes[e.idx];
+
+			if(node.count > 0){
+				func(node.offset, node.offset + node.count, r);
+			}else{
+				//visit nearer child first
+				const uint32_t l = e.idx + 1;
+				const uint32_t h = node.offset;
+				float t_l, t_h;
+				const bool hit_l = m_nodes[l].box.intersect(r.o(), inv_d, r.t_min(), r.t(), t_l);
+				const bool hit_h = m_nodes[h].box.intersect(r.o(), inv_d, r.t_min(), r.t(), t_h);
+				if(hit_l && hit_h){
+					if(t_l < t_h){
+						stack[top++] = entry{ h, t_h }; stack[top++] = entry{ l, t_l };
+					}else{
+						stack[top++] = entry{ l, t_l }; stack[top++] = entry{ h, t_h };
+					}
+				}else if(hit_l){
+					stack[top++] = entry{ l, t_l };
+				}else if(hit_h){
+					stack[top++] = entry{ h, t_h };
+				}
+			}
+		}
+	}
+
+	//any hit traversal (for visibility test)
+	//func(first, last) returns true if r intersects any of primitives [first,last)
+	template<class Func> bool intersect(const ray &r, Func func) const
+	{
+		if(m_nodes.empty()){
+			return false;
+		}
+
+		const vec3 inv_d(1 / r.d().x, 1 / r.d().y, 1 / r.d().z);
+
+		uint32_t stack[max_depth];
+		int top = 0;
+		stack[top++] = 0;
+
+		while(top > 0){
+
+			const uint32_t idx = stack[--top];
+			const node &node = m_nodes[idx];
+
+			float t_near;
+			if(node.box.intersect(r.o(), inv_d, r.t_min(), r.t(), t_near) == false){
+				continue;
+			}
+			if(node.count > 0){
+				if(func(node.offset, node.offset + node.count)){
+					return true;
+				}
+			}else{
+				//push far child (along split axis) first
+				if(r.d()[node.axis] < 0){
+					stack[top++] = idx + 1; stack[top++] = node.offset;
+				}else{
+					stack[top++] = node.offset; stack[top++] = idx + 1;
+				}
+			}
+		}
+		return false;
+	}
+
+	//any hit traversal of ray packet (for visibility tests of ray stream)
+	//rays: up to 32 rays, active: bit mask of rays to be traced
+	//func(first, last, i) returns true if rays[i] intersects any of primitives [first,last)
+	//return bit mask of occluded rays
+	template<class Func> uint32_t intersect(const ray *rays, const uint32_t active, Func func) const
+	{
+		if(m_nodes.empty() || (active == 0)){
+			return 0;
+		}
+
+		vec3 inv_d[32];
+		for(uint32_t m = active; m; m &= m - 1){
+			const int i = count_trailing_zeros(m);
+			inv_d[i] = vec3(1 / rays[i].d().x, 1 / rays[i].d().y, 1 / rays[i].d().z);
+		}
+
+		struct entry{
+			uint32_t idx; uint32_t mask;
+		};
+		entry stack[max_depth];
+		int top = 0;
+		stack[top++] = entry{ 0, active };
+
+		uint32_t occluded = 0;
+		while(top > 0){
+
+			const entry e = stack[--top];
+			const node &node = m_nodes[e.idx];
+
+			//rays in packet intersecting node
+			uint32_t mask = 0;
+			for(uint32_t m = e.mask & ~occluded; m; m &= m - 1){
+				const int i = count_trailing_zeros(m);
+				float t_near;
+				if(node.box.intersect(rays[i].o(), inv_d[i], rays[i].t_min(), rays[i].t(), t_near)){
+					mask |= 1u << i;
+				}
+			}
+			if(mask == 0){
+				continue;
+			}
+
+			if(node.count > 0){
+				for(uint32_t m = mask; m; m &= m - 1){
+					const int i = count_trailing_zeros(m);
+					if(func(node.offset, node.offset + node.count, i)){
+						occluded |= 1u << i;
+					}
+				}
+				if(occluded == active){
+					break;
+				}
+			}else{
+				//push far child (along split axis of first active ray) first
+				if(rays[count_trailing_zeros(mask)].d()[node.axis] < 0){
+					stack[top++] = entry{ e.idx + 1, mask }; stack[top++] = entry{ node.offset, mask };
+				}else{
+					stack[top++] = entry{ node.offset, mask }; stack[top++] = entry{ e.idx + 1, mask };
+				}
+			}
+		}
+		return occluded;
+	}
+
+	//return order of primitives (i-th primitive in leaves is indices()[i]-th primitive of constructor)
+	const std::vector<uint32_t> &indices() const
+	{
+		return m_indices;
+	}
+
+	size_t num_nodes() const
+	{
+		return m_nodes.size();
+	}
+
+private:
+
+	static const size_t num_bins = 16;
+	static const size_t min_leaf_size = 1;
+	static const size_t max_depth = 64;
+	static constexpr float traversal_cost = 1.0f; //cost of node traversal (primitive_cost is relative to it)
+
+	std::vector<node> m_nodes;
+	std::vector<uint32_t> m_indices;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif
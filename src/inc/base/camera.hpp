@@ -73,12 +73,13 @@ public:
 	{
 		const float t = m_focus / lens_wi.cos();
 		const vec3 screen_p = lens_p + vec3(lens_wi) * t;
-		const int pixel_x = int(dot(screen_p - m_screen_min, m_t) * m_res_x / m_screen_size_x);
-		const int pixel_y = int(dot(screen_p - m_screen_min, m_b) * m_res_y / m_screen_size_y);
+		const float pixel_x = dot(screen_p - m_screen_min, m_t) * m_res_x / m_screen_size_x;
+		const float pixel_y = dot(screen_p - m_screen_min, m_b) * m_res_y / m_screen_size_y;
 
+		//test before truncation (int() rounds (-1,0) up to pixel 0)
 		if((0 <= pixel_x) && (pixel_x < m_res_x)){
 			if((0 <= pixel_y) && (pixel_y < m_res_y)){
-				return intersection{pixel_x, pixel_y, true};
+				return intersection{int(pixel_x), int(pixel_y), true};
 			}
 		}
 		return intersection{-1, -1, false};
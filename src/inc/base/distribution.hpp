@@ -1,41 +1,202 @@
-
 #pragma once
 
 #ifndef DISTRIBUTION_HPP
 #define DISTRIBUTION_HPP
 
 #include<vector>
+#include<cassert>
+#include<cstdint>
 #include<algorithm>
 
 #include"rng.hpp"
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-//distribution
-///////////////////////////////////////////////////////////////////////////////////////////////////
+//index_distribution
+/*/////////////////////////////////////////////////////////////////////////////////////////////////
+distribution over indices [0,n) which stores only cdf
+it is used when a set of elements is shared by several distributions
+/////////////////////////////////////////////////////////////////////////////////////////////////*/
 
-template<class T> class distribution
+class index_distribution
 {
 public:
 
-	//elems: set of elements to construct distribution, weight: function object that returns weight
-	//distribution::sample samples element proportional to weight
-	//distribution::normalization_constant returns sum of weight
-	template<class Weight> distribution(std::vector<T> elems, Weight weight) : m_cdf(elems.size() + 1)
+	//n: number of indices, weight: function object that returns weight of i-th index
+	template<class Weight> index_distribution(const size_t n, Weight weight) : m_cdf(n + 1)
 	{
 		double sum = 0;
-		for(size_t i = 0, n = elems.size(); i < n; i++){
-			m_cdf[i] = float(sum); sum += weight(elems[i]);
+		for(size_t i = 0; i < n; i++){
+			m_cdf[i] = float(sum); sum += weight(i);
 		}
 
 		const float inv_sum = float(1 / sum);
-		for(size_t i = 0, n = elems.size(); i < n; i++){
+		for(size_t i = 0; i < n; i++){
 			m_cdf[i] *= inv_sum;
 		}
 		m_cdf.back() = 1;
-		m_elems = std::move(elems);
 		m_normalization_constant = float(sum);
 	}
-	distribution() : m_normalization_constant()
+
+	//weights: weight of each index
+	explicit index_distribution(const std::vector<float> &weights) : index_distribution(weights.size(), [&](const size_t i){ return weights[i]; })
+	{
+	}
+	index_distribution() : m_normalization_constant()
+	{
+	}
+
+	//idx: sampled index, pmf: sampling probability
+	struct sample_t{
+		size_t idx; float pmf;
+	};
+	sample_t sample(random_number_generator &rng) const
+	{
+		const size_t idx = std::upper_bound(m_cdf.begin(), m_cdf.end(), rng.generate_uniform_real()) - m_cdf.begin() - 1; //二分探索
+		return sample_t{ idx, m_cdf[idx + 1] - m_cdf[idx] };
+	}
+
+	//return pmf to sample idx-th element
+	float pmf(const size_t idx) const
+	{
+		return assert(idx < size()), m_cdf[idx + 1] - m_cdf[idx];
+	}
+
+	float normalization_constant() const
+	{
+		return m_normalization_constant;
+	}
+
+	//return number of indices
+	size_t size() const
+	{
+		return m_cdf.empty() ? 0 : m_cdf.size() - 1;
+	}
+
+private:
+
+	std::vector<float> m_cdf;
+	float m_normalization_constant;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//alias_table
+/*/////////////////////////////////////////////////////////////////////////////////////////////////
+distribution over indices [0,n) sampled in O(1) by Walker's alias method (constructed by Vose's algorithm)
+it has the same interface as index_distribution, and pmf is also returned in O(1)
+it requires 12 bytes per index, while index_distribution requires 4 bytes per index
+/////////////////////////////////////////////////////////////////////////////////////////////////*/
+
+class alias_table
+{
+public:
+
+	//n: number of indices, weight: function object that returns weight of i-th index
+	template<class Weight> alias_table(const size_t n, Weight weight) : m_table(n)
+	{
+		double sum = 0;
+		for(size_t i = 0; i < n; i++){
+			m_table[i].pmf = float(weight(i)); sum += m_table[i].pmf;
+		}
+		m_normalization_constant = float(sum);
+
+		//scaled probabilities (mean is 1) are split into small (<1) and large (>=1) ones
+		thread_local std::vector<double> scaled;
+		thread_local std::vector<uint32_t> small, large;
+		scaled.resize(n);
+		small.clear();
+		large.clear();
+
+		const double inv_sum = (sum > 0) ? 1 / sum : 0;
+		for(size_t i = 0; i < n; i++){
+			m_table[i].pmf = float(m_table[i].pmf * inv_sum);
+			scaled[i] = m_table[i].pmf * double(n);
+			((scaled[i] < 1) ? small : large).push_back(uint32_t(i));
+		}
+
+		//pair each small index with a large index
+		while(!small.empty() && !large.empty()){
+			const uint32_t s = small.back(); small.pop_back();
+			const uint32_t l = large.back(); large.pop_back();
+			m_table[s].prob = float(scaled[s]);
+			m_table[s].alias = l;
+			scaled[l] = (scaled[l] + scaled[s]) - 1;
+			((scaled[l] < 1) ? small : large).push_back(l);
+		}
+
+		//remaining indices have probability 1 (up to round-off error)
+		for(const uint32_t i : large){
+			m_table[i].prob = 1; m_table[i].alias = i;
+		}
+		for(const uint32_t i : small){
+			m_table[i].prob = 1; m_table[i].alias = i;
+		}
+	}
+
+	//weights: weight of each index
+	explicit alias_table(const std::vector<float> &weights) : alias_table(weights.size(), [&](const size_t i){ return weights[i]; })
+	{
+	}
+	alias_table() : m_normalization_constant()
+	{
+	}
+
+	//idx: sampled index, pmf: sampling probability
+	struct sample_t{
+		size_t idx; float pmf;
+	};
+	sample_t sample(random_number_generator &rng) const
+	{
+		size_t idx = rng.generate_uniform_int(0, m_table.size() - 1);
+		if(rng.generate_uniform_real() >= m_table[idx].prob){
+			idx = m_table[idx].alias;
+		}
+		return sample_t{ idx, m_table[idx].pmf };
+	}
+
+	//return pmf to sample idx-th element
+	float pmf(const size_t idx) const
+	{
+		return assert(idx < size()), m_table[idx].pmf;
+	}
+
+	float normalization_constant() const
+	{
+		return m_normalization_constant;
+	}
+
+	//return number of indices
+	size_t size() const
+	{
+		return m_table.size();
+	}
+
+private:
+
+	struct entry{
+		float prob;     //probability to accept index itself
+		uint32_t alias; //index sampled otherwise
+		float pmf;      //normalized weight
+	};
+	std::vector<entry> m_table;
+	float m_normalization_constant;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//distribution
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+//Table: index_distribution (binary search over cdf) or alias_table (O(1) sampling)
+template<class T, class Table = index_distribution> class distribution
+{
+public:
+
+	//elems: set of elements to construct distribution, weight: function object that returns weight
+	//distribution::sample samples element proportional to weight
+	//distribution::normalization_constant returns sum of weight
+	template<class Weight> distribution(std::vector<T> elems, Weight weight) : m_dist(elems.size(), [&](const size_t i){ return weight(elems[i]); }), m_elems(std::move(elems))
+	{
+	}
+	distribution()
 	{
 	}
 
@@ -46,19 +207,19 @@ public:
 	};
 	sample_t sample(random_number_generator &rng) const
 	{
-		const size_t idx = std::upper_bound(m_cdf.begin(), m_cdf.end(), rng.generate_uniform_real()) - m_cdf.begin() - 1; //二分探索
-		return sample_t{ &m_elems[idx], m_cdf[idx + 1] - m_cdf[idx] };
+		const auto sample = m_dist.sample(rng);
+		return sample_t{ &m_elems[sample.idx], sample.pmf };
 	}
 
 	//return pmf to sample idx-th element
 	float pmf(const size_t idx) const
 	{
-		return assert(idx < m_elems.size()), m_cdf[idx + 1] - m_cdf[idx];
+		return m_dist.pmf(idx);
 	}
 
 	float normalization_constant() const
 	{
-		return m_normalization_constant;
+		return m_dist.normalization_constant();
 	}
 
 	typename std::vector<T>::iterator begin()
@@ -80,9 +241,8 @@ public:
 
 private:
 
+	Table m_dist;
 	std::vector<T> m_elems;
-	std::vector<float> m_cdf;
-	float m_normalization_constant;
 };
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
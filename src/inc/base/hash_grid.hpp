@@ -0,0 +1,360 @@
+#pragma once
+
+#ifndef HASH_GRID_HPP
+#define HASH_GRID_HPP
+
+#include<cmath>
+#include<array>
+#include<vector>
+#include<cfloat>
+#include<cstdlib>
+#include<cstdint>
+#include<cassert>
+#include<algorithm>
+#include"aabb.hpp"
+#include"math.hpp"
+#include"kd_tree.hpp"
+#include"parallel.hpp"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//hash_grid
+/*/////////////////////////////////////////////////////////////////////////////////////////////////
+uniform grid over bounding box of elements whose non-empty cells are stored in hash table (open addressing)
+elements are stored contiguously for each cell, and positions are stored separately from elements
+cell size is chosen so that non-empty cells have about elems_per_cell elements on average:
+the first guess from volume of bounding box is corrected once by the measured occupancy,
+assuming that elements lie on surfaces (i.e., the number of elements per cell is proportional to squared cell size)
+find_nearest visits shells of cells around the cell of query point in order of distance,
+and stops when no unvisited cell can contain nearer elements (all elements are checked if shells become too large)
+this is an alternative to kd_tree with the same interface of find_nearest<K>, operator[] and begin/end
+/////////////////////////////////////////////////////////////////////////////////////////////////*/
+
+template<class T> class hash_grid
+{
+public:
+
+	//elems: set of elements, point: function object that returns position, elems_per_cell: average number of elements in non-empty cells
+	template<class Point> hash_grid(std::vector<T> elems, Point point, const float elems_per_cell = 8) : m_inv_h(), m_h(), m_bits()
+	{
+		build(elems, point, nullptr, elems_per_cell);
+	}
+
+	//positions of elements are hashed in parallel by threads of pool (grid is identical to that built by the above constructor)
+	template<class Point> hash_grid(std::vector<T> elems, Point point, thread_pool &pool, const float elems_per_cell = 8) : m_inv_h(), m_h(), m_bits()
+	{
+		build(elems, point, &pool, elems_per_cell);
+	}
+	hash_grid() : m_inv_h(), m_h(), m_bits()
+	{
+	}
+
+	//p: query point, r: query radius
+	//return K nearest elements in ascending order of distance (invalid neighbors are filled if less than K elements are found)
+	template<size_t K> std::array<neighbor<T>, K> find_nearest(const vec3 &p, const float r = FLT_MAX) const
+	{
+		nearest_set<T, K> nearest(r);
+
+		if(m_points.empty() == false){
+
+			//position of query point in units of cells, and cell of query point (clamped to grid)
+			const vec3 q = (p - m_min) * m_inv_h;
+			int c[3];
+			for(int k = 0; k < 3; k++){
+				c[k] = int(std::max(0.0f, std::min(std::floor(q[k]), float(m_dims[k] - 1))));
+			}
+
+			//visit cell (x,y,z) if it can contain nearer elements
+			auto visit = [&](const int x, const int y, const int z)
+			{
+				const int i[3] = { x, y, z };
+				float d2 = 0;
+				for(int k = 0; k < 3; k++){
+					const float d = std::max(0.0f, std::max(i[k] - q[k], q[k] - (i[k] + 1)));
+					d2 += d * d;
+				}
+				if(d2 * (m_h * m_h) < nearest.max_d2()){
+					const cell *ptr = find_cell(key(x, y, z));
+					if(ptr != nullptr){
+						for(uint32_t idx = ptr->first, last = ptr->first + ptr->count; idx < last; idx++){
+							nearest.insert(idx, squared_norm(p - m_points[idx]));
+						}
+					}
+				}
+			};
+
+			//visit d-th shell (cells whose chebyshev distance from c is d) while unvisited cells can contain nearer elements
+			size_t num_enumerated = 0;
+			for(int d = 0;; d++){
+
+				const int x0 = std::max(c[0] - d, 0), x1 = std::min(c[0] + d, m_dims[0] - 1);
+				const int y0 = std::max(c[1] - d, 0), y1 = std::min(c[1] + d, m_dims[1] - 1);
+				const int z0 = std::max(c[2] - d, 0), z1 = std::min(c[2] + d, m_dims[2] - 1);
+				for(int z = z0; z <= z1; z++){
+					for(int y = y0; y <= y1; y++){
+						if((std::abs(z - c[2]) == d) || (std::abs(y - c[1]) == d)){
+							for(int x = x0; x <= x1; x++){
+								visit(x, y, z);
+							}
+							num_enumerated += x1 - x0 + 1;
+						}else{
+							if(c[0] - d >= 0){
+								visit(c[0] - d, y, z);
+							}
+							if(c[0] + d < m_dims[0]){
+								visit(c[0] + d, y, z);
+							}
+							num_enumerated += 2;
+						}
+					}
+				}
+
+				//lower bound of distance to cells outside of shells [0,d] (FLT_MAX if all cells are visited)
+				float bound = FLT_MAX;
+				for(int k = 0; k < 3; k++){
+					if(c[k] - d > 0){
+						bound = std::min(bound, q[k] - (c[k] - d));
+					}
+					if(c[k] + d + 1 < m_dims[k]){
+						bound = std::min(bound, (c[k] + d + 1) - q[k]);
+					}
+				}
+				if((bound == FLT_MAX) || (bound * bound * (m_h * m_h) >= nearest.max_d2())){
+					break;
+				}
+
+				//query point is far from elements (e.g., outside of grid), so that all elements are checked instead of more shells
+				if(num_enumerated > m_num_cells){
+					nearest.clear(r);
+					for(uint32_t idx = 0, n = uint32_t(m_points.size()); idx < n; idx++){
+						nearest.insert(idx, squared_norm(p - m_points[idx]));
+					}
+					break;
+				}
+			}
+		}
+
+		return nearest.neighbors(m_elems);
+	}
+
+	//ps: query points, neighbors: store K nearest elements of ps[i] in neighbors[i], r: query radius
+	//queries are answered in parallel in order of morton codes (see query_in_morton_order)
+	template<size_t K> void find_nearest(const std::vector<vec3> &ps, std::vector<std::array<neighbor<T>, K>> &neighbors, thread_pool &pool, const float r = FLT_MAX) const
+	{
+		neighbors.resize(ps.size());
+		query_in_morton_order(ps, pool, [&](const size_t i){
+			neighbors[i] = find_nearest<K>(ps[i], r);
+		});
+	}
+
+	//return idx-th element (in order of begin/end)
+	const T &operator[](const size_t idx) const
+	{
+		return m_elems[idx];
+	}
+
+	typename std::vector<T>::const_iterator begin() const
+	{
+		return m_elems.begin();
+	}
+	typename std::vector<T>::const_iterator end() const
+	{
+		return m_elems.end();
+	}
+
+	//return size of cells
+	float cell_size() const
+	{
+		return m_h;
+	}
+
+	//return number of non-empty cells
+	size_t num_cells() const
+	{
+		return m_num_cells;
+	}
+
+private:
+
+	//non-empty cell (elements [first,first+count) are in the cell)
+	struct cell{
+		uint64_t key; uint32_t first; uint32_t count;
+	};
+
+	//return key of cell (x,y,z)
+	static uint64_t key(const int x, const int y, const int z)
+	{
+		return uint64_t(x) | (uint64_t(y) << 21) | (uint64_t(z) << 42);
+	}
+
+	//return index of slot of hash table with 2^bits slots
+	static size_t hash(const uint64_t key, const int bits)
+	{
+		return size_t((key * 0x9e3779b97f4a7c15ull) >> (64 - bits));
+	}
+
+	//return cell of key (nullptr if cell is empty)
+	const cell *find_cell(const uint64_t key) const
+	{
+		const size_t mask = m_cells.size() - 1;
+		for(size_t i = hash(key, m_bits);; i = (i + 1) & mask){
+			const cell &c = m_cells[i];
+			if(c.key == key){
+				return &c;
+			}
+			if(c.key == empty_key){
+				return nullptr;
+			}
+		}
+	}
+
+	//insert key into hash table (slots of 2^bits) if it is not found, and return index of slot
+	static size_t insert_key(std::vector<cell> &cells, const int bits, const uint64_t key, size_t &num_cells)
+	{
+		const size_t mask = cells.size() - 1;
+		for(size_t i = hash(key, bits);; i = (i + 1) & mask){
+			if(cells[i].key == key){
+				return i;
+			}
+			if(cells[i].key == empty_key){
+				cells[i] = cell{ key, 0, 0 };
+				num_cells++;
+				return i;
+			}
+		}
+	}
+
+	//build grid (serially if pool is nullptr)
+	template<class Point> void build(std::vector<T> &elems, Point point, thread_pool *p_pool, const float elems_per_cell)
+	{
+		const size_t num = elems.size();
+		if(num == 0){
+			return;
+		}
+		assert(num < size_t(uint32_t(-1)));
+
+		auto for_each = [&](auto func){
+			if(p_pool != nullptr){
+				p_pool->parallel_for(int(num), [&](const int i){ func(size_t(i)); });
+			}else{
+				for(size_t i = 0; i < num; i++){
+					func(i);
+				}
+			}
+		};
+
+		std::vector<vec3> points(num);
+		for_each([&](const size_t i){
+			points[i] = point(elems[i]);
+		});
+		aabb box;
+		for(const auto &p : points){
+			box.expand(p);
+		}
+		const vec3 ext = box.max() - box.min();
+		const float max_ext = std::max(ext.x, std::max(ext.y, ext.z));
+		m_min = box.min();
+
+		//hash positions with cell size h, and return number of non-empty cells
+		//slots of elements are stored in slots, and temporary hash table has at least 2*num slots
+		std::vector<uint64_t> keys(num);
+		std::vector<size_t> slots(num);
+		int bits = 1;
+		while((size_t(1) << bits) < 2 * num){
+			bits++;
+		}
+		std::vector<cell> cells;
+		auto hash_points = [&](const float h){
+			m_h = h;
+			m_inv_h = 1 / h;
+			for(int k = 0; k < 3; k++){
+				m_dims[k] = std::min(int(ext[k] * m_inv_h) + 1, max_dim);
+			}
+			for_each([&](const size_t i){
+				const vec3 q = (points[i] - m_min) * m_inv_h;
+				int c[3];
+				for(int k = 0; k < 3; k++){
+					c[k] = std::min(int(q[k]), m_dims[k] - 1);
+				}
+				keys[i] = key(c[0], c[1], c[2]);
+			});
+			cells.assign(size_t(1) << bits, cell{ empty_key, 0, 0 });
+			size_t num_cells = 0;
+			for(size_t i = 0; i < num; i++){
+				slots[i] = insert_key(cells, bits, keys[i], num_cells);
+			}
+			return num_cells;
+		};
+
+		//cell size (the first guess is corrected by occupancy of cells)
+		const float min_h = max_ext / (max_dim - 1);
+		float volume = 1;
+		for(int k = 0; k < 3; k++){
+			volume *= std::max(ext[k], max_ext * 1e-3f);
+		}
+		float h = (max_ext > 0) ? std::max(std::cbrt(volume * elems_per_cell / num), min_h) : 1;
+		if(max_ext > 0){
+			const float occupancy = float(num) / hash_points(h);
+			h = std::max(h * std::sqrt(elems_per_cell / occupancy), min_h);
+		}
+		m_num_cells = hash_points(h);
+
+		//final hash table with at least 2*num_cells slots
+		m_bits = 1;
+		while((size_t(1) << m_bits) < 2 * m_num_cells){
+			m_bits++;
+		}
+		m_cells.assign(size_t(1) << m_bits, cell{ empty_key, 0, 0 });
+		std::vector<size_t> final_slots(cells.size());
+		size_t num_cells = 0;
+		for(size_t i = 0; i < cells.size(); i++){
+			if(cells[i].key != empty_key){
+				final_slots[i] = insert_key(m_cells, m_bits, cells[i].key, num_cells);
+			}
+		}
+
+		//elements are sorted by slots (counting sort), so that elements of each cell are contiguous
+		for(size_t i = 0; i < num; i++){
+			m_cells[final_slots[slots[i]]].count++;
+		}
+		uint32_t first = 0;
+		for(auto &c : m_cells){
+			c.first = first;
+			first += c.count;
+		}
+		std::vector<uint32_t> order(num);
+		std::vector<uint32_t> next(m_cells.size());
+		for(size_t i = 0; i < m_cells.size(); i++){
+			next[i] = m_cells[i].first;
+		}
+		for(size_t i = 0; i < num; i++){
+			order[next[final_slots[slots[i]]]++] = uint32_t(i);
+		}
+
+		m_points.resize(num);
+		m_elems.reserve(num);
+		for(size_t i = 0; i < num; i++){
+			m_points[i] = points[order[i]];
+			m_elems.push_back(std::move(elems[order[i]]));
+		}
+	}
+
+private:
+
+	//key of empty slots, and maximum number of cells along each axis (coordinates of cells are packed in 21 bits)
+	static constexpr uint64_t empty_key = uint64_t(-1);
+	static constexpr int max_dim = 1 << 21;
+
+	vec3 m_min;             //minimum corner of grid
+	float m_inv_h;          //1/cell size
+	float m_h;              //cell size
+	int m_dims[3] = {};     //number of cells along each axis
+	int m_bits;             //hash table has 2^m_bits slots
+	size_t m_num_cells = 0; //number of non-empty cells
+	std::vector<cell> m_cells;
+	std::vector<vec3> m_points;
+	std::vector<T> m_elems;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif
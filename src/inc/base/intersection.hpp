@@ -25,7 +25,7 @@ public:
 	}
 
 	//p: intersection point, n: normal at p, p_mtl: address of mtl for p
-	intersection(const vec3 &p, const vec3 &n, const material *p_mtl) : m_p(p), m_n(n), m_is_valid(true), mp_mtl(p_mtl)
+	intersection(const vec3 &p, const vec3 &n, const ::material *p_mtl) : m_p(p), m_n(n), m_is_valid(true), mp_mtl(p_mtl)
 	{
 	}
 	
@@ -40,7 +40,7 @@ public:
 	}
 
 	//return material
-	const material &material() const
+	const ::material &material() const
 	{
 		return assert(is_valid() && (mp_mtl != nullptr)), *mp_mtl;
 	}
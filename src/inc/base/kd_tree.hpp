@@ -4,9 +4,17 @@
 #ifndef KD_TREE_HPP
 #define KD_TREE_HPP
 
-#include<queue>
+#include<array>
 #include<vector>
+#include<cfloat>
+#include<cstdint>
+#include<cstring>
+#include<cassert>
+#include<algorithm>
+#include"aabb.hpp"
 #include"math.hpp"
+#include"simd.hpp"
+#include"parallel.hpp"
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 //neighbor
@@ -16,15 +24,31 @@ template<class T> class neighbor
 {
 public:
 
-	neighbor(const T &elem, const float d2) : mp_elem(&elem), m_d2(d2)
+	//idx: index of elem in kd_tree
+	neighbor(const T &elem, const float d2, const uint32_t idx) : mp_elem(&elem), m_d2(d2), m_idx(idx)
 	{
 	}
+	neighbor() : mp_elem(), m_d2(FLT_MAX), m_idx(uint32_t(-1))
+	{
+	}
+
+	//return false if no element is found (e.g., the number of elements is less than k of find_nearest<k>)
+	bool is_valid() const
+	{
+		return (mp_elem != nullptr);
+	}
 
 	float d2() const
 	{
 		return m_d2;
 	}
 
+	//return index of element (operator[] of kd_tree/hash_grid returns the element)
+	uint32_t index() const
+	{
+		return m_idx;
+	}
+
 	const T &operator*() const
 	{
 		return *mp_elem;
@@ -38,131 +62,504 @@ private:
 
 	const T *mp_elem; 
 	float m_d2;
+	uint32_t m_idx;
 };
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-//kd_tree
+//nearest_set
+/*/////////////////////////////////////////////////////////////////////////////////////////////////
+K nearest elements found so far by find_nearest<K> of spatial indices (kd_tree, hash_grid)
+squared distances and indices are kept in ascending order in fixed-size arrays by insertion with selects,
+so that neither heap allocation nor sort occurs
+/////////////////////////////////////////////////////////////////////////////////////////////////*/
+
+template<class T, size_t K> class nearest_set
+{
+public:
+
+	static_assert(K > 0, "K must be positive");
+
+	//r: query radius
+	explicit nearest_set(const float r)
+	{
+		clear(r);
+	}
+
+	//remove all elements
+	void clear(const float r)
+	{
+		for(size_t j = 0; j < K; j++){
+			m_d2s[j] = r * r; m_ids[j] = uint32_t(-1);
+		}
+	}
+
+	//return squared radius (squared distance of K-th nearest element if K elements are found)
+	float max_d2() const
+	{
+		return m_d2s[K - 1];
+	}
+
+	//idx: index of element, d2: squared distance of element
+	void insert(const uint32_t idx, const float d2)
+	{
+		if(d2 < m_d2s[K - 1]){
+			//each slot takes the previous slot, the element, or keeps its own
+			for(size_t j = K - 1; j > 0; j--){
+				const bool shift = (d2 < m_d2s[j - 1]), take = (d2 < m_d2s[j]);
+				m_ids[j] = shift ? m_ids[j - 1] : (take ? idx : m_ids[j]);
+				m_d2s[j] = shift ? m_d2s[j - 1] : (take ? d2 : m_d2s[j]);
+			}
+			m_ids[0] = (d2 < m_d2s[0]) ? idx : m_ids[0];
+			m_d2s[0] = (d2 < m_d2s[0]) ? d2 : m_d2s[0];
+		}
+	}
+
+	//elems: elements of spatial index (elems[idx] is idx-th element)
+	//return neighbors in ascending order of distance (invalid neighbors are filled if less than K elements are found)
+	template<class Elems> std::array<neighbor<T>, K> neighbors(const Elems &elems) const
+	{
+		std::array<neighbor<T>, K> neighbors;
+		for(size_t j = 0; j < K; j++){
+			if(m_ids[j] != uint32_t(-1)){
+				neighbors[j] = neighbor<T>(elems[m_ids[j]], m_d2s[j], m_ids[j]);
+			}
+		}
+		return neighbors;
+	}
+
+private:
+
+	float m_d2s[K];
+	uint32_t m_ids[K];
+};
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
+//query_in_morton_order
+/*/////////////////////////////////////////////////////////////////////////////////////////////////
+batch of queries of spatial indices (kd_tree, hash_grid)
+query(i) is called for all query points ps[i] in order of morton codes of ps (in bounding box of ps),
+and chunks of consecutive queries are processed in parallel by threads of pool,
+so that each thread visits nodes/cells similar to those visited by the previous queries (i.e., data in cache)
+/////////////////////////////////////////////////////////////////////////////////////////////////*/
+
+template<class Func> inline void query_in_morton_order(const std::vector<vec3> &ps, thread_pool &pool, Func query)
+{
+	//number of consecutive queries processed by each thread at once
+	const size_t chunk_size = 256;
+
+	const size_t n = ps.size();
+	if(n == 0){
+		return;
+	}
+	const int num_chunks = int((n + chunk_size - 1) / chunk_size);
+	auto for_each_chunk = [&](auto func){
+		pool.parallel_for(num_chunks, [&](const int c){
+			for(size_t i = c * chunk_size, i1 = std::min(i + chunk_size, n); i < i1; i++){
+				func(i);
+			}
+		});
+	};
+
+	//sort query points by morton codes
+	aabb box;
+	for(const auto &p : ps){
+		box.expand(p);
+	}
+	const vec3 ext = box.max() - box.min();
+	const vec3 scale(
+		(ext.x > 0) ? 1023 / ext.x : 0, (ext.y > 0) ? 1023 / ext.y : 0, (ext.z > 0) ? 1023 / ext.z : 0
+	);
+	thread_local std::vector<std::pair<uint32_t, uint32_t>> buf;
+	auto &keys = buf; //buffer of calling thread (thread_local variables are not captured by lambdas)
+	keys.resize(n);
+	for_each_chunk([&](const size_t i){
+		const vec3 p = (ps[i] - box.min()) * scale;
+		keys[i] = std::make_pair(morton_code(uint32_t(p.x), uint32_t(p.y), uint32_t(p.z)), uint32_t(i));
+	});
+	std::sort(keys.begin(), keys.end());
+
+	for_each_chunk([&](const size_t i){
+		query(size_t(keys[i].second));
+	});
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//kd_tree
+/*/////////////////////////////////////////////////////////////////////////////////////////////////
+implicit balanced kd-tree (children of idx-th node are (2*idx+1)-th and (2*idx+2)-th nodes)
+positions and axes of nodes are stored in a dense array separately from elements (payloads),
+so that traversal reads 16 bytes per node (4 nodes per cache line) regardless of size of elements
+/////////////////////////////////////////////////////////////////////////////////////////////////*/
 
 template<class T> class kd_tree
 {
 public:
 
+	//position and axis of split of node (k=-1 for leaves)
 	struct node{
-		node() = default;
-		node(node&&) = default;
-		node(const node&) = delete;
-		node &operator=(node&&) = default;
-		node &operator=(const node&) = delete;
-		node(const vec3 &p, const int k, T &&elem) : p(p), k(k){
+		vec3 p; int k;
+	};
+
+	//element of node (constructed when node is constructed)
+	struct payload{
+		payload() = default;
+		payload(const payload&) = delete;
+		payload &operator=(const payload&) = delete;
+		void construct(T &&elem){
 			new (&storage) T(std::move(elem));
 		}
-		~node(){
+		~payload(){
 			reinterpret_cast<T&>(storage).~T();
 		}
 		operator const T&() const{
 			return reinterpret_cast<const T&>(storage);
 		}
-		vec3 p; int k; std::aligned_storage_t<sizeof(T), alignof(T)> storage;
+		std::aligned_storage_t<sizeof(T), alignof(T)> storage;
 	};
 
 	//elems: set of elements, point: function object that returns position
-	template<class Point> kd_tree(std::vector<T> elems, Point point) : m_nodes(elems.size())
+	template<class Point> kd_tree(std::vector<T> elems, Point point) : m_nodes(elems.size()), m_payloads(elems.size())
 	{
-		auto implement = [&](const size_t idx, auto first, auto last, const int depth, auto *This) -> void
-		{
-			const size_t num = last - first;
-			if(num == 1){
-				m_nodes[idx] = node(point(*first), -1, std::move(*first));
-			} else{
-				const int k = depth % 3;
+		build(elems, point, nullptr, false);
+	}
 
-				const size_t subtree_height = size_t(ceil(log2(num + 1))) - 1;
-				auto mid = first + std::min((size_t(1) << subtree_height) - 1, num - (size_t(1) << (subtree_height - 1)));
+	//subtrees are built in parallel by threads of pool, and medians of top levels are selected in parallel if parallel_selection is true
+	//layout of tree is identical to that built by the above constructor
+	template<class Point> kd_tree(std::vector<T> elems, Point point, thread_pool &pool, const bool parallel_selection = true) : m_nodes(elems.size()), m_payloads(elems.size())
+	{
+		build(elems, point, &pool, parallel_selection);
+	}
+	kd_tree() = default;
 
-				std::nth_element(first, mid, last, [&, k](const T &a, const T &b){
-					return (point(a)[k] < point(b)[k]);
-				});
+	//p: query point, r: query radius
+	//return K nearest elements in ascending order of distance (invalid neighbors are filled if less than K elements are found)
+	//tree is traversed with explicit stack and K nearest elements are kept in nearest_set,
+	//so that neither heap allocation nor recursion occurs (leaves are checked without being pushed to stack)
+	template<size_t K> std::array<neighbor<T>, K> find_nearest(const vec3 &p, const float r = FLT_MAX) const
+	{
+		nearest_set<T, K> nearest(r);
 
-				m_nodes[idx] = node(point(*mid), k, std::move(*mid));
+		//subtrees to be visited with squared distance to splitting plane
+		struct entry{
+			uint32_t idx; float d2;
+		};
+		entry stack[max_depth];
+		int top = 0;
+
+		//nodes [0,size/2) have children and the others are leaves
+		const uint32_t size = uint32_t(m_nodes.size());
+		const uint32_t num_inner_nodes = size / 2;
+		if(size > 0){
+			stack[top++] = entry{ 0, 0 };
+		}
+		while(top > 0){
+
+			const entry e = stack[--top];
+			if(e.d2 >= nearest.max_d2()){
+				continue;
+			}
+
+			//descend along nearer children, pushing farther children
+			uint32_t idx = e.idx;
+			while(idx < num_inner_nodes){
 
-				{
-					(*This)(2 * idx + 1, first, mid, depth + 1, This);
+				const node &node = m_nodes[idx];
+				const uint32_t l = 2 * idx + 1;
+
+				//prefetch children while the current node is processed
+				prefetch(&m_nodes[l]);
+				if(l + 1 < size){
+					prefetch(&m_nodes[l + 1]);
 				}
-				if(++mid != last){
-					(*This)(2 * idx + 2, mid,  last, depth + 1, This);
+
+				const float diff_k = p[node.k] - node.p[node.k];
+				nearest.insert(idx, squared_norm(p - node.p));
+
+				const uint32_t near = (diff_k < 0) ? l : l + 1;
+				const uint32_t far  = (diff_k < 0) ? l + 1 : l;
+				if(far >= num_inner_nodes){
+					//leaves are checked immediately instead of being pushed
+					if(far < size){
+						nearest.insert(far, squared_norm(p - m_nodes[far].p));
+					}
+				}else{
+					//entry is pushed without branch and discarded by not incrementing top
+					stack[top] = entry{ far, diff_k * diff_k };
+					top += int(diff_k * diff_k < nearest.max_d2());
 				}
+				idx = near;
 			}
-		};
-		implement(0, elems.begin(), elems.end(), 0, &implement);
+			if(idx < size){
+				nearest.insert(idx, squared_norm(p - m_nodes[idx].p));
+			}
+		}
+
+		return nearest.neighbors(m_payloads);
 	}
-	kd_tree() = default;
 
-	//p: query point, r: query radius, n: number of elements, neighbors: store neighbor elements
-	void find_nearest(const vec3 &p, const float r, const size_t n, std::vector<neighbor<T>> &neighbors) const
+	//ps: query points, neighbors: store K nearest elements of ps[i] in neighbors[i], r: query radius
+	//queries are answered in parallel in order of morton codes (see query_in_morton_order)
+	template<size_t K> void find_nearest(const std::vector<vec3> &ps, std::vector<std::array<neighbor<T>, K>> &neighbors, thread_pool &pool, const float r = FLT_MAX) const
 	{
-		float r2 = r * r;
-		auto implement = [&, p, n, this](const size_t idx, auto *This) -> void
-		{
-			if(idx >= m_nodes.size()){
-				return;
+		neighbors.resize(ps.size());
+		query_in_morton_order(ps, pool, [&](const size_t i){
+			neighbors[i] = find_nearest<K>(ps[i], r);
+		});
+	}
+
+	//return idx-th element (in order of begin/end)
+	const T &operator[](const size_t idx) const
+	{
+		return m_payloads[idx];
+	}
+
+	typename std::vector<payload>::const_iterator begin() const
+	{
+		return m_payloads.begin();
+	}
+	typename std::vector<payload>::const_iterator end() const
+	{
+		return m_payloads.end();
+	}
+
+private:
+
+	//position and index of element to be selected (elements are moved only when nodes are constructed)
+	struct item{
+		vec3 p; uint32_t id;
+	};
+
+	//subtree with root m_nodes[idx] consisting of elements items[first,last)
+	struct subtree{
+		size_t idx; size_t first; size_t last; int depth;
+	};
+
+	//build tree (serially if pool is nullptr)
+	//elements are selected through positions and indices, and ties of coordinates are broken by indices,
+	//so that the median of each subtree (i.e., layout of tree) does not depend on algorithms and threads of selection
+	template<class Point> void build(std::vector<T> &elems, Point point, thread_pool *p_pool, const bool parallel_selection)
+	{
+		const size_t num = elems.size();
+		if(num == 0){
+			return;
+		}
+		assert(num < size_t(uint32_t(-1)));
+
+		std::vector<item> items(num);
+		auto init = [&](const size_t i){
+			items[i] = item{ point(elems[i]), uint32_t(i) };
+		};
+		if(p_pool != nullptr){
+			p_pool->parallel_for(int(num), [&](const int i){ init(i); });
+		}else{
+			for(size_t i = 0; i < num; i++){
+				init(i);
 			}
-			const node &node = m_nodes[idx];
+		}
 
-			const vec3 diff(
-				p - node.p
-			);
-			if(2 * idx + 1 < m_nodes.size()){
-				const float diff1_k = diff[node.k];
-				const float diff2_k = diff[node.k] * diff[node.k];
-
-				if(diff1_k < 0){
-					(*This)(2 * idx + 1, This); if(diff2_k < r2){ (*This)(2 * idx + 2, This); }
-				} else{
-					(*This)(2 * idx + 2, This); if(diff2_k < r2){ (*This)(2 * idx + 1, This); }
-				}
+		//split subtree at median (items[mid] is root and the others are partitioned) and construct root
+		//children are returned through first and second of pair (invalid if first == last)
+		auto split = [&](const subtree &s, const bool in_parallel){
+			const size_t n = s.last - s.first;
+			if(n == 1){
+				m_nodes[s.idx] = node{ items[s.first].p, -1 };
+				m_payloads[s.idx].construct(std::move(elems[items[s.first].id]));
+				return std::make_pair(subtree{ 0, 0, 0, 0 }, subtree{ 0, 0, 0, 0 });
 			}
+			const int k = s.depth % 3;
 
-			const float d2 = squared_norm(diff);
+			const size_t subtree_height = size_t(ceil(log2(n + 1))) - 1;
+			const size_t mid = s.first + std::min((size_t(1) << subtree_height) - 1, n - (size_t(1) << (subtree_height - 1)));
 
-			if(d2 < r2){
+			if(in_parallel){
+				select_in_parallel(items, s.first, mid, s.last, k, *p_pool);
+			}else{
+				std::nth_element(items.begin() + s.first, items.begin() + mid, items.begin() + s.last, [k](const item &a, const item &b){
+					return (a.p[k] < b.p[k]) || ((a.p[k] == b.p[k]) && (a.id < b.id));
+				});
+			}
+			m_nodes[s.idx] = node{ items[mid].p, k };
+			m_payloads[s.idx].construct(std::move(elems[items[mid].id]));
 
-				neighbors.emplace_back(node, d2);
+			return std::make_pair(
+				subtree{ 2 * s.idx + 1, s.first, mid, s.depth + 1 }, subtree{ 2 * s.idx + 2, mid + 1, s.last, s.depth + 1 }
+			);
+		};
 
-				auto pred = [](const auto &a, const auto &b){
-					return (a.d2() < b.d2());
-				};
-				if(neighbors.size() > n){
-					std::push_heap(neighbors.begin(), neighbors.end(), pred);
-					std:: pop_heap(neighbors.begin(), neighbors.end(), pred); neighbors.pop_back();
-					r2 = neighbors.front().d2();
+		auto implement = [&](const subtree &s, auto *This) -> void
+		{
+			const auto children = split(s, false);
+			if(children.first.first != children.first.last){
+				(*This)(children.first, This);
+			}
+			if(children.second.first != children.second.last){
+				(*This)(children.second, This);
+			}
+		};
+
+		if((p_pool == nullptr) || (p_pool->num_threads() == 1)){
+			implement(subtree{ 0, 0, num, 0 }, &implement);
+		}else{
+			//top levels are split level by level (subtrees of each level are split in parallel, and medians of large subtrees are
+			//selected in parallel while subtrees are fewer than threads), until there are enough subtrees to be built in parallel
+			const size_t nt = p_pool->num_threads();
+			std::vector<subtree> level{ subtree{ 0, 0, num, 0 } }, next;
+			while((level.empty() == false) && (level.size() < 4 * nt)){
+
+				std::vector<std::pair<subtree, subtree>> children(level.size());
+				if(parallel_selection && (level.size() < nt)){
+					for(size_t i = 0; i < level.size(); i++){
+						const bool large = (level[i].last - level[i].first >= min_parallel_selection);
+						children[i] = split(level[i], large);
+					}
+				}else{
+					p_pool->parallel_for(int(level.size()), [&](const int i){
+						children[i] = split(level[i], false);
+					});
 				}
-				else if(neighbors.size() == n){
-					std::make_heap(neighbors.begin(), neighbors.end(), pred);
-					r2 = neighbors.front().d2();
+
+				next.clear();
+				for(const auto &c : children){
+					if(c.first.first != c.first.last){
+						next.push_back(c.first);
+					}
+					if(c.second.first != c.second.last){
+						next.push_back(c.second);
+					}
 				}
+				level.swap(next);
 			}
-		};
-		neighbors.clear();
-		implement(0, &implement);
+			p_pool->parallel_for(int(level.size()), [&](const int i){
+				implement(level[i], &implement);
+			});
+		}
+	}
 
-		if(neighbors.size() < n){
-			std::make_heap(neighbors.begin(), neighbors.end(), [](const auto &a, const auto &b){ return (a.d2() < b.d2()); });
+	//return unsigned integer in the same order as coordinate (-0 and +0 are equal)
+	static uint32_t ordered_bits(const float val)
+	{
+		uint32_t bits;
+		std::memcpy(&bits, &val, 4);
+		if(bits == (uint32_t(1) << 31)){
+			return uint32_t(1) << 31;
 		}
+		return bits ^ (((bits >> 31) != 0) ? uint32_t(-1) : (uint32_t(1) << 31));
 	}
 
-	typename std::vector<node>::const_iterator begin() const
+	//partition items[first,last) in k-th coordinate, so that items[nth] is the same element as that placed by std::nth_element
+	//coordinate of items[nth] is found by radix selection with histograms of chunks counted in parallel, then elements are scattered
+	//into less/equal/greater coordinates in parallel, and elements with equal coordinates are selected by indices
+	static void select_in_parallel(std::vector<item> &items, const size_t first, const size_t nth, const size_t last, const int k, thread_pool &pool)
 	{
-		return m_nodes.begin();
+		const size_t num_chunks = (last - first + chunk_size - 1) / chunk_size;
+		auto for_each_chunk = [&](auto func){
+			pool.parallel_for(int(num_chunks), [&](const int c){
+				func(size_t(c), first + c * chunk_size, std::min(first + (c + 1) * chunk_size, last));
+			});
+		};
+		auto coord = [k](const item &item){
+			return ordered_bits(item.p[k]);
+		};
+
+		//radix selection of coordinate (11+11+10 bits from the top)
+		uint32_t median = 0, median_mask = 0;
+		size_t rank = nth - first;
+		{
+			const int shifts[] = { 21, 10, 0 };
+			const uint32_t digit_masks[] = { 0x7ff, 0x7ff, 0x3ff };
+			std::vector<uint32_t> histograms(num_chunks * 2048);
+			for(int pass = 0; pass < 3; pass++){
+
+				const int shift = shifts[pass];
+				const uint32_t digit_mask = digit_masks[pass];
+
+				std::fill(histograms.begin(), histograms.end(), 0);
+				for_each_chunk([&](const size_t c, const size_t i0, const size_t i1){
+					uint32_t *histogram = &histograms[c * 2048];
+					for(size_t i = i0; i < i1; i++){
+						const uint32_t x = coord(items[i]);
+						if((x & median_mask) == median){
+							histogram[(x >> shift) & digit_mask]++;
+						}
+					}
+				});
+
+				for(uint32_t digit = 0; digit <= digit_mask; digit++){
+					size_t count = 0;
+					for(size_t c = 0; c < num_chunks; c++){
+						count += histograms[c * 2048 + digit];
+					}
+					if(rank < count){
+						median |= digit << shift; median_mask |= digit_mask << shift; break;
+					}
+					rank -= count;
+				}
+			}
+		}
+
+		//count elements with less/equal coordinates in each chunk, and compute offsets of chunks by prefix sums
+		std::vector<size_t> counts(2 * num_chunks);
+		for_each_chunk([&](const size_t c, const size_t i0, const size_t i1){
+			size_t num_less = 0, num_equal = 0;
+			for(size_t i = i0; i < i1; i++){
+				const uint32_t x = coord(items[i]);
+				num_less += (x < median); num_equal += (x == median);
+			}
+			counts[2 * c + 0] = num_less; counts[2 * c + 1] = num_equal;
+		});
+		size_t num_less = 0, num_equal = 0;
+		for(size_t c = 0; c < num_chunks; c++){
+			num_less += counts[2 * c + 0]; num_equal += counts[2 * c + 1];
+		}
+		std::vector<size_t> offsets(3 * num_chunks);
+		for(size_t c = 0, less = 0, equal = num_less, greater = num_less + num_equal; c < num_chunks; c++){
+			const size_t c_less = counts[2 * c + 0], c_equal = counts[2 * c + 1];
+			const size_t c_greater = std::min(chunk_size, last - first - c * chunk_size) - c_less - c_equal;
+			offsets[3 * c + 0] = less; offsets[3 * c + 1] = equal; offsets[3 * c + 2] = greater;
+			less += c_less; equal += c_equal; greater += c_greater;
+		}
+
+		//scatter elements and copy them back
+		std::vector<item> tmp(last - first);
+		for_each_chunk([&](const size_t c, const size_t i0, const size_t i1){
+			size_t o[3] = { offsets[3 * c + 0], offsets[3 * c + 1], offsets[3 * c + 2] };
+			for(size_t i = i0; i < i1; i++){
+				const uint32_t x = coord(items[i]);
+				tmp[o[(x < median) ? 0 : ((x == median) ? 1 : 2)]++] = items[i];
+			}
+		});
+		for_each_chunk([&](const size_t, const size_t i0, const size_t i1){
+			std::copy(tmp.begin() + (i0 - first), tmp.begin() + (i1 - first), items.begin() + i0);
+		});
+
+		//select among elements with equal coordinates by indices
+		assert(nth == first + num_less + rank);
+		std::nth_element(items.begin() + first + num_less, items.begin() + nth, items.begin() + first + num_less + num_equal, [](const item &a, const item &b){
+			return (a.id < b.id);
+		});
 	}
-	typename std::vector<node>::const_iterator end() const
+
+	//prefetch node into cache
+	static void prefetch(const node *ptr)
 	{
-		return m_nodes.end();
+#if defined(__GNUC__) || defined(__clang__)
+		__builtin_prefetch(ptr);
+#elif defined(SIMD_X86)
+		_mm_prefetch(reinterpret_cast<const char*>(ptr), _MM_HINT_T0);
+#endif
 	}
 
 private:
 
-	std::vector<node> m_nodes;
+	//maximum depth of tree (tree is balanced, so that 2^64 elements are never reached)
+	static constexpr int max_depth = 64;
+
+	//number of elements per chunk, and minimum number of elements of subtrees whose medians are selected in parallel
+	static constexpr size_t chunk_size = 1 << 14;
+	static constexpr size_t min_parallel_selection = 1 << 16;
+
+	std::vector<node> m_nodes;       //positions and axes visited by traversal
+	std::vector<payload> m_payloads; //elements of m_nodes
 };
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
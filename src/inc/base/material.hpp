@@ -70,12 +70,6 @@ public:
 
 	brdf(const intersection &x, const direction &w, const col3 &kd) : m_f(kd / PI()), m_n(x.n())
 	{
-		if(abs(m_n.x) < abs(m_n.y)){
-			m_t = normalize(vec3(0, m_n.z, -m_n.y));
-		}else{
-			m_t = normalize(vec3(-m_n.z, 0, m_n.x));
-		}
-		m_b = cross(m_n, m_t);
 	}
 	brdf() = default;
 
@@ -98,8 +92,17 @@ public:
 		const float cp = cos(ph);
 		const float sp = sin(ph);
 
+		//tangent frame is built only for sampling, so that brdf is cheap to construct for evaluation
+		vec3 t;
+		if(std::abs(m_n.x) < std::abs(m_n.y)){
+			t = normalize(vec3(0, m_n.z, -m_n.y));
+		}else{
+			t = normalize(vec3(-m_n.z, 0, m_n.x));
+		}
+		const vec3 b = cross(m_n, t);
+
 		const direction w(
-			m_t * (st * cp) + m_b * (st * sp) + m_n * (ct), m_n
+			t * (st * cp) + b * (st * sp) + m_n * (ct), m_n
 		);
 		return brdf_sample(w, f(w), pdf(w));
 	}
@@ -112,8 +115,6 @@ public:
 private:
 
 	col3 m_f;
-	vec3 m_t;
-	vec3 m_b;
 	vec3 m_n;
 };
 
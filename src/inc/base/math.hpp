@@ -6,6 +6,8 @@
 
 #include<cfloat>
 #include<cassert>
+#include<cstdint>
+#include<algorithm>
 
 #include"math/vec3.hpp"
 #include"math/vec4.hpp"
@@ -46,4 +48,20 @@ inline float clamp(const float val, const float min, const float max)
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
+//30-bit morton code of 10-bit integer coordinates (x,y,z) (larger values are clamped)
+inline uint32_t morton_code(const uint32_t x, const uint32_t y, const uint32_t z)
+{
+	auto expand = [](uint32_t v){
+		v = std::min(v, 1023u);
+		v = (v | (v << 16)) & 0x030000ffu;
+		v = (v | (v <<  8)) & 0x0300f00fu;
+		v = (v | (v <<  4)) & 0x030c30c3u;
+		v = (v | (v <<  2)) & 0x09249249u;
+		return v;
+	};
+	return (expand(x) << 2) | (expand(y) << 1) | expand(z);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
 #endif
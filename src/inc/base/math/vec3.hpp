@@ -5,6 +5,8 @@
 #define VEC3_HPP
 
 #include<cmath>
+#include<cstdint>
+#include<algorithm>
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 //forward declaration
@@ -170,4 +172,39 @@ inline float luminance(const col3 &c)
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
+//encode unit vector into 32 bits (two 16-bit coordinates of octahedral mapping)
+inline uint32_t encode_oct(const vec3 &n)
+{
+	const float l1 = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+	if(l1 == 0){
+		return 0;
+	}
+	float u = n.x / l1;
+	float v = n.y / l1;
+	if(n.z < 0){
+		//fold lower hemisphere over diagonals
+		const float tu = (1 - std::abs(v)) * ((u >= 0) ? 1 : -1);
+		const float tv = (1 - std::abs(u)) * ((v >= 0) ? 1 : -1);
+		u = tu; v = tv;
+	}
+	auto quantize = [](const float x){
+		return uint32_t(int32_t(std::round(std::min(std::max(x, -1.0f), 1.0f) * 32767)) & 0xffff);
+	};
+	return quantize(u) | (quantize(v) << 16);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+//decode unit vector encoded by encode_oct
+inline vec3 decode_oct(const uint32_t code)
+{
+	const float u = int16_t(code & 0xffff) / 32767.0f;
+	const float v = int16_t(code >> 16) / 32767.0f;
+	const float z = 1 - std::abs(u) - std::abs(v);
+	const float t = std::max(-z, 0.0f);
+	return normalize(vec3(u + ((u >= 0) ? -t : t), v + ((v >= 0) ? -t : t), z));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
 #endif
@@ -41,6 +41,16 @@ public:
 		return sample_point(sample.p(), sample.n(), &m_mtl, sample.pdf());
 	}
 
+	const sphere &shape() const
+	{
+		return m_sph;
+	}
+
+	aabb bounds() const
+	{
+		return m_sph.bounds();
+	}
+
 	float light_power() const
 	{
 		return m_mtl.is_emissive() ? luminance(m_mtl.Me()) * m_sph.area() : 0;
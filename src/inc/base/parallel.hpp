@@ -8,6 +8,10 @@
 #include<thread>
 #include<vector>
 #include<atomic>
+#include<cstdint>
+#include<utility>
+#include<algorithm>
+#include<condition_variable>
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 //spinlock
@@ -34,48 +38,314 @@ private:
 };
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-//function definitions
-///////////////////////////////////////////////////////////////////////////////////////////////////
+//thread_pool
+/*/////////////////////////////////////////////////////////////////////////////////////////////////
+persistent worker threads which evaluate parallel_for repeatedly without creating threads
+calling thread also evaluates func, so that nt-1 worker threads are created for nt threads
+thread_local variables (e.g., camera_path) of workers survive across parallel_for
+parallel_for called from func is evaluated serially by the calling thread
 
+parallel_for_tiles splits 2D domain into tiles ordered along Hilbert curve
+each thread owns contiguous range of tiles (i.e., neighboring tiles) and processes it from the front,
+and threads that finished their ranges steal tiles from the back of ranges of the others
+/////////////////////////////////////////////////////////////////////////////////////////////////*/
 
-//evaluate func( x, y ) in parallel with nt threads
-template<class Func> inline void in_parallel(const int nx, const int ny, Func func, const size_t nt = std::thread::hardware_concurrency())
+class thread_pool
 {
-	std::atomic<int> idx = 0;
-	std::vector<std::thread> threads(nt);
+public:
 
-	for(auto &thread : threads){
+	//nt: number of threads (including calling thread)
+	explicit thread_pool(const size_t nt = std::thread::hardware_concurrency()) : m_ranges(std::max<size_t>(nt, 1)), m_generation(), m_num_running(), m_quit(), m_job()
+	{
+		for(size_t i = 1, n = std::max<size_t>(nt, 1); i < n; i++){
+			m_workers.emplace_back([this, i](){ worker(i); });
+		}
+	}
+	~thread_pool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mtx); m_quit = true;
+		}
+		m_cv_start.notify_all();
+		for(auto &worker : m_workers){
+			worker.join();
+		}
+	}
+	thread_pool(const thread_pool&) = delete;
+	thread_pool &operator=(const thread_pool&) = delete;
 
-		thread = std::thread([&](){
-			for(int i = idx.fetch_add(1); i < nx * ny; i = idx.fetch_add(1)){
-				const int y = i / nx;
-				const int x = i - nx * y;
-				func(x, y);
-			}
+	//evaluate func(x, y) in parallel
+	template<class Func> void parallel_for(const int nx, const int ny, Func func)
+	{
+		parallel_for(nx * ny, [&](const int i){
+			const int y = i / nx;
+			const int x = i - nx * y;
+			func(x, y);
 		});
 	}
-	for(auto &thread : threads){
-		thread.join();
+
+	//evaluate func(i) in parallel
+	template<class Func> void parallel_for(const int nx, Func func)
+	{
+		if(nx <= 0){
+			return;
+		}
+		std::atomic<int> idx(0);
+		dispatch([&](const size_t){
+			for(int i = idx.fetch_add(1); i < nx; i = idx.fetch_add(1)){
+				func(i);
+			}
+		});
 	}
-}
 
-//evaluate func(i) in parallel with nt threads
-template<class Func> inline void in_parallel(const int nx, Func func, const size_t nt = std::thread::hardware_concurrency())
-{
-	std::atomic<int> idx = 0;
-	std::vector<std::thread> threads(nt);
+	//evaluate func(x, y) in parallel tile by tile (tile_size x tile_size pixels)
+	template<class Func> void parallel_for_tiles(const int nx, const int ny, const int tile_size, Func func)
+	{
+		if((nx <= 0) || (ny <= 0)){
+			return;
+		}
+		if(is_worker()){
+			//nested loop does not touch ranges of outer loop
+			for(int y = 0; y < ny; y++){
+				for(int x = 0; x < nx; x++){
+					func(x, y);
+				}
+			}
+			return;
+		}
+		const int ts = std::max(tile_size, 1);
+		const int tx = (nx + ts - 1) / ts;
+		const int ty = (ny + ts - 1) / ts;
+		const std::vector<uint32_t> &order = tile_order(tx, ty);
 
-	for(auto &thread : threads){
+		auto process = [&](const uint32_t tile){
+			const int x0 = ts * int(tile % tx), x1 = std::min(x0 + ts, nx);
+			const int y0 = ts * int(tile / tx), y1 = std::min(y0 + ts, ny);
+			for(int y = y0; y < y1; y++){
+				for(int x = x0; x < x1; x++){
+					func(x, y);
+				}
+			}
+		};
 
-		thread = std::thread([&](){
-			for(int i = idx.fetch_add(1); i < nx; i = idx.fetch_add(1)){
-				func(i);
+		//contiguous ranges along curve are assigned to threads
+		const size_t nt = m_ranges.size(), n = order.size();
+		for(size_t i = 0; i < nt; i++){
+			m_ranges[i].value.store(pack(uint32_t(n * i / nt), uint32_t(n * (i + 1) / nt)), std::memory_order_relaxed);
+		}
+
+		dispatch([&](const size_t tid){
+			uint32_t i;
+			while(pop_front(m_ranges[tid].value, i)){
+				process(order[i]);
+			}
+			for(size_t j = 1; j < nt; j++){
+				auto &victim = m_ranges[(tid + j) % nt].value;
+				while(steal_back(victim, i)){
+					process(order[i]);
+				}
 			}
 		});
 	}
-	for(auto &thread : threads){
-		thread.join();
+
+	//return number of threads (including calling thread)
+	size_t num_threads() const
+	{
+		return m_workers.size() + 1;
 	}
+
+	//return index [0,num_threads()) of thread evaluating func (0 for calling thread and outside of pool)
+	static size_t thread_index()
+	{
+		return tid();
+	}
+
+private:
+
+	//type-erased body of parallel loop (body is alive until dispatch returns)
+	struct job{
+		void (*invoke)(const void *p_body, const size_t tid); const void *p_body;
+	};
+
+	//evaluate body(tid) on all threads (tid=0 for calling thread)
+	template<class Body> void dispatch(const Body &body)
+	{
+		if(m_workers.empty() || is_worker()){
+			//calling thread plays roles of all threads
+			const bool flag = is_worker();
+			is_worker() = true;
+			for(size_t tid = 0; tid < m_ranges.size(); tid++){
+				body(tid);
+			}
+			is_worker() = flag;
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(m_mtx);
+			m_job = job{ [](const void *p_body, const size_t tid){ (*static_cast<const Body*>(p_body))(tid); }, &body };
+			m_num_running = m_workers.size();
+			m_generation++;
+		}
+		m_cv_start.notify_all();
+
+		is_worker() = true; tid() = 0;
+		body(0);
+		is_worker() = false;
+
+		std::unique_lock<std::mutex> lock(m_mtx);
+		m_cv_finish.wait(lock, [&](){ return m_num_running == 0; });
+	}
+
+	void worker(const size_t tid)
+	{
+		is_worker() = true; thread_pool::tid() = tid;
+
+		size_t generation = 0;
+		while(true){
+			job job;
+			{
+				std::unique_lock<std::mutex> lock(m_mtx);
+				m_cv_start.wait(lock, [&](){ return m_quit || (m_generation != generation); });
+				if(m_quit){
+					return;
+				}
+				generation = m_generation; job = m_job;
+			}
+			job.invoke(job.p_body, tid);
+			{
+				std::lock_guard<std::mutex> lock(m_mtx);
+				if(--m_num_running == 0){
+					m_cv_finish.notify_one();
+				}
+			}
+		}
+	}
+
+	//true while thread evaluates body of dispatch
+	static bool &is_worker()
+	{
+		thread_local bool flag = false;
+		return flag;
+	}
+
+	//index of thread in pool
+	static size_t &tid()
+	{
+		thread_local size_t idx = 0;
+		return idx;
+	}
+
+	//range [first,last) of tiles is packed into 64 bits, so that owner and thieves update it by CAS
+	static uint64_t pack(const uint32_t first, const uint32_t last)
+	{
+		return (uint64_t(last) << 32) | first;
+	}
+	static bool pop_front(std::atomic<uint64_t> &range, uint32_t &idx)
+	{
+		uint64_t val = range.load(std::memory_order_relaxed);
+		while(uint32_t(val) < uint32_t(val >> 32)){
+			if(range.compare_exchange_weak(val, val + 1, std::memory_order_relaxed)){
+				idx = uint32_t(val); return true;
+			}
+		}
+		return false;
+	}
+	static bool steal_back(std::atomic<uint64_t> &range, uint32_t &idx)
+	{
+		uint64_t val = range.load(std::memory_order_relaxed);
+		while(uint32_t(val) < uint32_t(val >> 32)){
+			if(range.compare_exchange_weak(val, val - (uint64_t(1) << 32), std::memory_order_relaxed)){
+				idx = uint32_t(val >> 32) - 1; return true;
+			}
+		}
+		return false;
+	}
+
+	//return tiles (index x+tx*y) of tx x ty grid sorted along Hilbert curve (cached for the last grid)
+	const std::vector<uint32_t> &tile_order(const int tx, const int ty)
+	{
+		if((m_order_tx == tx) && (m_order_ty == ty)){
+			return m_order;
+		}
+
+		int n = 1;
+		while((n < tx) || (n < ty)){
+			n *= 2;
+		}
+		auto hilbert = [n](int x, int y){
+			uint64_t d = 0;
+			for(int s = n / 2; s > 0; s /= 2){
+				const int rx = (x & s) > 0;
+				const int ry = (y & s) > 0;
+				d += uint64_t(s) * s * ((3 * rx) ^ ry);
+				if(ry == 0){
+					if(rx == 1){
+						x = s - 1 - x; y = s - 1 - y;
+					}
+					std::swap(x, y);
+				}
+			}
+			return d;
+		};
+
+		std::vector<std::pair<uint64_t, uint32_t>> keys(size_t(tx) * ty);
+		for(int y = 0; y < ty; y++){
+			for(int x = 0; x < tx; x++){
+				keys[x + tx * y] = std::make_pair(hilbert(x, y), uint32_t(x + tx * y));
+			}
+		}
+		std::sort(keys.begin(), keys.end());
+
+		m_order.resize(keys.size());
+		for(size_t i = 0; i < keys.size(); i++){
+			m_order[i] = keys[i].second;
+		}
+		m_order_tx = tx; m_order_ty = ty;
+		return m_order;
+	}
+
+private:
+
+	//range of tiles owned by each thread (aligned to avoid false sharing)
+	struct alignas(64) range{
+		std::atomic<uint64_t> value;
+	};
+
+	std::vector<std::thread> m_workers;
+	std::vector<range> m_ranges;
+	std::mutex m_mtx;
+	std::condition_variable m_cv_start;
+	std::condition_variable m_cv_finish;
+	size_t m_generation;  //incremented for each dispatch
+	size_t m_num_running; //number of workers evaluating current job
+	bool m_quit;
+	job m_job;
+	std::vector<uint32_t> m_order; //tiles along Hilbert curve for m_order_tx x m_order_ty grid
+	int m_order_tx = 0;
+	int m_order_ty = 0;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//function definitions
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+//evaluate func( x, y ) in parallel with persistent threads of pool
+template<class Func> inline void in_parallel(const int nx, const int ny, Func func, thread_pool &pool)
+{
+	pool.parallel_for(nx, ny, func);
+}
+
+//evaluate func(i) in parallel with persistent threads of pool
+template<class Func> inline void in_parallel(const int nx, Func func, thread_pool &pool)
+{
+	pool.parallel_for(nx, func);
+}
+
+//evaluate func( x, y ) in parallel tile by tile with persistent threads of pool
+template<class Func> inline void in_parallel(const int nx, const int ny, const int tile_size, Func func, thread_pool &pool)
+{
+	pool.parallel_for_tiles(nx, ny, tile_size, func);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -1,46 +1,421 @@
-
 #pragma once
 
 #ifndef RANDOM_NUMBER_GENERATOR_HPP
 #define RANDOM_NUMBER_GENERATOR_HPP
 
-#include<random>
+#include<cstddef>
+#include<cstdint>
+#include<cstring>
+
+#include"simd.hpp"
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-//random_number_generator
+//philox4x32
+/*/////////////////////////////////////////////////////////////////////////////////////////////////
+counter-based engine (Philox4x32-10 by Salmon et al. 2011)
+i-th block of 16 numbers is the function of (seed, stream, index, i) only,
+so that a sequence keyed by e.g. (pixel, iteration) does not depend on threads which evaluate it
+four counters are evaluated at once by SSE2
+/////////////////////////////////////////////////////////////////////////////////////////////////*/
+
+class philox4x32
+{
+public:
+
+	//number of 32-bit numbers generated at once
+	static const size_t block_size = 16;
+
+	//blocks can be generated in any order
+	static const bool random_access = true;
+
+	//seed: key of engine, stream: index of sequence, index: index of sample (e.g., iteration)
+	philox4x32(const uint64_t seed, const uint64_t stream, const uint32_t index) : m_key{ uint32_t(seed), uint32_t(seed >> 32) }, m_stream(stream), m_index(index)
+	{
+	}
+
+	//generate idx-th block (idx<2^30) (j-th number of block is (j%4)-th output of Philox for counter (4*idx+j/4, index, stream))
+	void generate(const uint64_t idx, uint32_t *block)
+	{
+#if defined(SIMD_X86)
+		generate_sse(idx, block);
+#else
+		for(size_t i = 0; i < 4; i++){
+			generate_scalar(uint32_t(4 * idx + i), block + 4 * i);
+		}
+#endif
+	}
+
+private:
+
+	static const uint32_t M0 = 0xD2511F53u, M1 = 0xCD9E8D57u;
+	static const uint32_t W0 = 0x9E3779B9u, W1 = 0xBB67AE85u;
+
+	void generate_scalar(const uint32_t ctr, uint32_t *out) const
+	{
+		uint32_t c[4] = { ctr, m_index, uint32_t(m_stream), uint32_t(m_stream >> 32) };
+		uint32_t k[2] = { m_key[0], m_key[1] };
+		for(int r = 0; r < 10; r++){
+			const uint64_t p0 = uint64_t(M0) * c[0];
+			const uint64_t p1 = uint64_t(M1) * c[2];
+			const uint32_t tmp[4] = { uint32_t(p1 >> 32) ^ c[1] ^ k[0], uint32_t(p1), uint32_t(p0 >> 32) ^ c[3] ^ k[1], uint32_t(p0) };
+			c[0] = tmp[0]; c[1] = tmp[1]; c[2] = tmp[2]; c[3] = tmp[3];
+			k[0] += W0; k[1] += W1;
+		}
+		out[0] = c[0]; out[1] = c[1]; out[2] = c[2]; out[3] = c[3];
+	}
+
+#if defined(SIMD_X86)
+
+	//i-th lane of c0..c3 holds words of counter 4*idx+i
+	SIMD_TARGET("sse2") void generate_sse(const uint64_t idx, uint32_t *block) const
+	{
+		__m128i c0 = _mm_add_epi32(_mm_set1_epi32(int(uint32_t(4 * idx))), _mm_setr_epi32(0, 1, 2, 3));
+		__m128i c1 = _mm_set1_epi32(int(m_index));
+		__m128i c2 = _mm_set1_epi32(int(uint32_t(m_stream)));
+		__m128i c3 = _mm_set1_epi32(int(uint32_t(m_stream >> 32)));
+		__m128i k0 = _mm_set1_epi32(int(m_key[0]));
+		__m128i k1 = _mm_set1_epi32(int(m_key[1]));
+		const __m128i m0 = _mm_set1_epi32(int(M0)), m1 = _mm_set1_epi32(int(M1));
+		const __m128i w0 = _mm_set1_epi32(int(W0)), w1 = _mm_set1_epi32(int(W1));
+
+		//32x32->64 bit products of 4 lanes (lo and hi words)
+		auto mulhilo = [](const __m128i a, const __m128i m, __m128i &lo, __m128i &hi){
+			const __m128i p02 = _mm_mul_epu32(a, m);
+			const __m128i p13 = _mm_mul_epu32(_mm_srli_epi64(a, 32), m);
+			const __m128i t01 = _mm_unpacklo_epi32(p02, p13); //lo0, lo1, hi0, hi1
+			const __m128i t23 = _mm_unpackhi_epi32(p02, p13); //lo2, lo3, hi2, hi3
+			lo = _mm_unpacklo_epi64(t01, t23);
+			hi = _mm_unpackhi_epi64(t01, t23);
+		};
+		for(int r = 0; r < 10; r++){
+			__m128i lo0, hi0, lo1, hi1;
+			mulhilo(c0, m0, lo0, hi0);
+			mulhilo(c2, m1, lo1, hi1);
+			c0 = _mm_xor_si128(_mm_xor_si128(hi1, c1), k0);
+			c1 = lo1;
+			c2 = _mm_xor_si128(_mm_xor_si128(hi0, c3), k1);
+			c3 = lo0;
+			k0 = _mm_add_epi32(k0, w0); k1 = _mm_add_epi32(k1, w1);
+		}
+
+		//transpose words of counters into consecutive numbers
+		const __m128i t0 = _mm_unpacklo_epi32(c0, c1), t1 = _mm_unpacklo_epi32(c2, c3);
+		const __m128i t2 = _mm_unpackhi_epi32(c0, c1), t3 = _mm_unpackhi_epi32(c2, c3);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(block +  0), _mm_unpacklo_epi64(t0, t1));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(block +  4), _mm_unpackhi_epi64(t0, t1));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(block +  8), _mm_unpacklo_epi64(t2, t3));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(block + 12), _mm_unpackhi_epi64(t2, t3));
+	}
+
+#endif
+
+	uint32_t m_key[2];
+	uint64_t m_stream;
+	uint32_t m_index;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//xoshiro256p
+/*/////////////////////////////////////////////////////////////////////////////////////////////////
+sequential engine (xoshiro256+ by Blackman and Vigna 2018) with four independent states in SIMD lanes
+states are seeded by splitmix64 of (seed, stream, index, lane), and blocks must be generated in order
+upper 32 bits of outputs are used, since lower bits of xoshiro256+ have low linear complexity
+/////////////////////////////////////////////////////////////////////////////////////////////////*/
+
+class xoshiro256p
+{
+public:
+
+	//number of 32-bit numbers generated at once
+	static const size_t block_size = 16;
+
+	//blocks are generated in order
+	static const bool random_access = false;
+
+	//seed: key of engine, stream: index of sequence, index: index of sample (e.g., iteration)
+	xoshiro256p(const uint64_t seed, const uint64_t stream, const uint32_t index)
+	{
+		uint64_t x = seed ^ (stream * 0xD1B54A32D192ED03ull) ^ (uint64_t(index) * 0xAEF17502108EF2D9ull);
+		auto splitmix64 = [&](){
+			uint64_t z = (x += 0x9E3779B97F4A7C15ull);
+			z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+			z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+			return z ^ (z >> 31);
+		};
+		for(size_t w = 0; w < 4; w++){
+			for(size_t lane = 0; lane < 4; lane++){
+				m_s[w][lane] = splitmix64();
+			}
+		}
+	}
+
+	//generate next block (j-th number of block is upper bits of (j/4)-th output of (j%4)-th lane)
+	void generate(const uint64_t, uint32_t *block)
+	{
+#if defined(SIMD_X86)
+		generate_sse(block);
+#else
+		for(size_t i = 0; i < 4; i++){
+			for(size_t lane = 0; lane < 4; lane++){
+				uint64_t *s[4] = { &m_s[0][lane], &m_s[1][lane], &m_s[2][lane], &m_s[3][lane] };
+				block[4 * i + lane] = uint32_t((*s[0] + *s[3]) >> 32);
+				const uint64_t t = *s[1] << 17;
+				*s[2] ^= *s[0]; *s[3] ^= *s[1]; *s[1] ^= *s[2]; *s[0] ^= *s[3]; *s[2] ^= t;
+				*s[3] = (*s[3] << 45) | (*s[3] >> 19);
+			}
+		}
+#endif
+	}
+
+private:
+
+#if defined(SIMD_X86)
+
+	//lanes (0,1) and (2,3) are held in two registers
+	SIMD_TARGET("sse2") void generate_sse(uint32_t *block)
+	{
+		__m128i s[4][2];
+		for(size_t w = 0; w < 4; w++){
+			s[w][0] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&m_s[w][0]));
+			s[w][1] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&m_s[w][2]));
+		}
+		for(size_t i = 0; i < 4; i++){
+			__m128i r[2];
+			for(size_t h = 0; h < 2; h++){
+				r[h] = _mm_srli_epi64(_mm_add_epi64(s[0][h], s[3][h]), 32);
+				const __m128i t = _mm_slli_epi64(s[1][h], 17);
+				s[2][h] = _mm_xor_si128(s[2][h], s[0][h]);
+				s[3][h] = _mm_xor_si128(s[3][h], s[1][h]);
+				s[1][h] = _mm_xor_si128(s[1][h], s[2][h]);
+				s[0][h] = _mm_xor_si128(s[0][h], s[3][h]);
+				s[2][h] = _mm_xor_si128(s[2][h], t);
+				s[3][h] = _mm_or_si128(_mm_slli_epi64(s[3][h], 45), _mm_srli_epi64(s[3][h], 19));
+			}
+			//gather lower words of 64-bit lanes (upper bits of outputs)
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(block + 4 * i), _mm_unpacklo_epi64(_mm_shuffle_epi32(r[0], 0x08), _mm_shuffle_epi32(r[1], 0x08)));
+		}
+		for(size_t w = 0; w < 4; w++){
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(&m_s[w][0]), s[w][0]);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(&m_s[w][2]), s[w][1]);
+		}
+	}
+
+#endif
+
+	uint64_t m_s[4][4]; //m_s[word][lane]
+};
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
+//uniform_random_number_generator
+/*/////////////////////////////////////////////////////////////////////////////////////////////////
+uniform random numbers drawn from blocks of 32-bit numbers generated by Engine (philox4x32 or xoshiro256p)
+a sequence is determined by (seed, stream, index) for both engines
+/////////////////////////////////////////////////////////////////////////////////////////////////*/
 
-class random_number_generator
+template<class Engine> class uniform_random_number_generator
 {
 public:
 
-	//constructor
-	random_number_generator(const size_t seed = std::mt19937_64::default_seed) : m_engine(seed)
+	//constructor (seed: key of generator, stream: index of sequence, index: index of sample in stream)
+	uniform_random_number_generator(const uint64_t seed = 0, const uint64_t stream = 0, const uint32_t index = 0) : m_engine(seed, stream, index), m_dim(), m_block_idx(~uint64_t(0))
 	{
 	}
 
 	//generate uniform random variable [0,1)
 	float generate_uniform_real()
 	{
-		const float tmp = std::generate_canonical<float, size_t( -1 )>(m_engine);
-		if(tmp < 1){
-			return tmp;
+		//upper 23 bits are set to mantissa of [1,2)
+		const uint32_t bits = (next() >> 9) | 0x3f800000u;
+		float val;
+		std::memcpy(&val, &bits, sizeof(float));
+		return val - 1;
+	}
+
+	//generate uniform random variable of integers in [min,max] (without bias of modulo, by Lemire 2019)
+	size_t generate_uniform_int(const size_t min, const size_t max)
+	{
+		const uint64_t range = uint64_t(max - min) + 1;
+		if(range - 1 <= 0xffffffffull){
+			const uint32_t s = uint32_t(range - 1) + 1; //s=0 for range 2^32
+			if(s == 0){
+				return min + next();
+			}
+			uint64_t m = uint64_t(next()) * s;
+			if(uint32_t(m) < s){
+				const uint32_t t = (0u - s) % s;
+				while(uint32_t(m) < t){
+					m = uint64_t(next()) * s;
+				}
+			}
+			return min + size_t(m >> 32);
 		}else{
-			return 1 - FLT_EPSILON * 0.5f;
+			//rejection of 64-bit numbers (range > 2^32)
+			const uint64_t t = (range == 0) ? 0 : (0 - range) % range;
+			while(true){
+				const uint64_t hi = next();
+				const uint64_t x = (hi << 32) | next();
+				if(x >= t){
+					return min + size_t((range == 0) ? x : x % range);
+				}
+			}
+		}
+	}
+
+	//return dimension (index of 32-bit number generated next)
+	uint64_t dimension() const
+	{
+		return m_dim;
+	}
+
+	//skip to dimension dim (ignored by sequential engine)
+	void set_dimension(const uint64_t dim)
+	{
+		if(Engine::random_access){
+			m_dim = dim;
+		}
+	}
+
+private:
+
+	//return dim-th 32-bit random number
+	uint32_t next()
+	{
+		const uint64_t idx = m_dim / Engine::block_size;
+		if(idx != m_block_idx){
+			m_engine.generate(idx, m_block); m_block_idx = idx;
 		}
+		return m_block[(m_dim++) % Engine::block_size];
+	}
+
+private:
+
+	Engine m_engine;
+	uint64_t m_dim;
+	uint64_t m_block_idx; //index of block stored in m_block
+	uint32_t m_block[Engine::block_size];
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//sobol_sampler
+/*/////////////////////////////////////////////////////////////////////////////////////////////////
+low discrepancy sampler by shuffled and Owen-scrambled Sobol sequence (Burley 2020)
+index-th sample of stream (e.g., index: iteration, stream: pixel) is drawn from 2D Sobol points (dims 0 and 1),
+and each pair of dimensions (2k,2k+1) uses its own shuffle of index and own scramble,
+so that pairs are stratified over samples of stream while they are decorrelated from each other
+dimensions should be assigned consistently by set_dimension (e.g., the same dimensions for the same bounce)
+/////////////////////////////////////////////////////////////////////////////////////////////////*/
+
+class sobol_sampler
+{
+public:
+
+	//constructor (seed: key of sampler, stream: index of sequence, index: index of sample in stream)
+	sobol_sampler(const uint64_t seed = 0, const uint64_t stream = 0, const uint32_t index = 0) : m_key(hash(seed ^ hash(stream))), m_index(index), m_dim()
+	{
 	}
 
-	//generate uniform random variable of integers in [min,max]
+	//generate dim-th coordinate of sample [0,1)
+	float generate_uniform_real()
+	{
+		//upper 23 bits are set to mantissa of [1,2)
+		const uint32_t bits = (next() >> 9) | 0x3f800000u;
+		float val;
+		std::memcpy(&val, &bits, sizeof(float));
+		return val - 1;
+	}
+
+	//generate integers in [min,max] from dim-th coordinate (by multiplication to keep stratification)
 	size_t generate_uniform_int(const size_t min, const size_t max)
 	{
-		return min + (m_engine() % (max - min + 1));
+		const uint64_t range = uint64_t(max - min) + 1;
+		if((range != 0) && (range <= 0x100000000ull)){
+			return min + size_t((uint64_t(next()) * range) >> 32);
+		}else{
+			const uint64_t hi = next();
+			const uint64_t x = (hi << 32) | next();
+			return min + size_t((range == 0) ? x : x % range);
+		}
+	}
+
+	//return dimension (index of coordinate generated next)
+	uint64_t dimension() const
+	{
+		return m_dim;
+	}
+
+	//skip to dimension dim
+	void set_dimension(const uint64_t dim)
+	{
+		m_dim = dim;
 	}
 
 private:
 
-	std::mt19937_64 m_engine;
+	//return dim-th coordinate in 32-bit fixed point
+	uint32_t next()
+	{
+		const uint64_t pair = m_dim >> 1;
+		const uint32_t comp = uint32_t(m_dim & 1);
+		m_dim++;
+
+		const uint32_t idx = nested_uniform_scramble(m_index, uint32_t(hash(m_key ^ (2 * pair))));
+		const uint32_t val = (comp == 0) ? reverse_bits(idx) : sobol1(idx);
+		return nested_uniform_scramble(val, uint32_t(hash(m_key ^ (2 * pair + 1)) >> (32 * comp)));
+	}
+
+	//2nd dimension of Sobol sequence (1st dimension is reverse_bits(idx))
+	static uint32_t sobol1(uint32_t idx)
+	{
+		uint32_t val = 0;
+		for(uint32_t v = 1u << 31; idx; idx >>= 1, v ^= v >> 1){
+			if(idx & 1){
+				val ^= v;
+			}
+		}
+		return val;
+	}
+
+	static uint32_t reverse_bits(uint32_t x)
+	{
+		x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+		x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+		x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+		x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+		return (x >> 16) | (x << 16);
+	}
+
+	//Owen scrambling of bits from most significant bit (by Laine-Karras style hash)
+	static uint32_t nested_uniform_scramble(uint32_t x, const uint32_t seed)
+	{
+		x = reverse_bits(x);
+		x += seed;
+		x ^= x * 0x6c50b47cu;
+		x ^= x * 0xb82f1e52u;
+		x ^= x * 0xc7afe638u;
+		x ^= x * 0x8d22f6e6u;
+		return reverse_bits(x);
+	}
+
+	static uint64_t hash(uint64_t x)
+	{
+		x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+		x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+		return x ^ (x >> 31);
+	}
+
+private:
+
+	uint64_t m_key;
+	uint32_t m_index;
+	uint64_t m_dim;
 };
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
+//sampler of uniform numbers used by renderer
+//sobol_sampler (low discrepancy) or uniform_random_number_generator<philox4x32> / uniform_random_number_generator<xoshiro256p> (independent samples)
+using random_number_generator = sobol_sampler;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
 #endif
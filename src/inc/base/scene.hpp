@@ -4,8 +4,15 @@
 #ifndef SCENE_HPP
 #define SCENE_HPP
 
+#include<mutex>
+#include<atomic>
+#include<memory>
+#include<thread>
+
+#include"bvh.hpp"
 #include"object.hpp"
 #include"distribution.hpp"
+#include"sphere_array.hpp"
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 //scene
@@ -15,32 +22,180 @@ class scene
 {
 public:
 
-	scene(std::vector<object> objs)
+	scene(std::vector<object> objs) : m_id(++s_num_scenes)
 	{
+		//construct bvh over objects
+		//each leaf holds as many objects as sphere_array tests at once (i.e., each object in leaf costs 1/width of a test)
+		std::vector<aabb> bounds;
+		for(const auto &obj : objs){
+			bounds.push_back(obj.bounds());
+		}
+		const size_t width = std::max(simd_width(active_simd_isa()), 4);
+		m_bvh = bvh(bounds, width, 1.0f / width);
+
+		//sort objects in bvh order so that objects in each leaf are stored contiguously
+		std::vector<object> sorted_objs;
+		std::vector<sphere> spheres;
+		for(const auto idx : m_bvh.indices()){
+			sorted_objs.push_back(objs[idx]); spheres.push_back(objs[idx].shape());
+		}
+		m_spheres = sphere_array(spheres);
+
 		//construct distribution to sample points on light sources
-		m_objs = distribution<object>(std::move(objs), [](const object &obj){ return obj.light_power(); });
+		m_objs = distribution<object, alias_table>(std::move(sorted_objs), [](const object &obj){ return obj.light_power(); });
 	}
 
 	//calculate intersection
 	intersection calc_intersection(ray &r) const
 	{
 		intersection isect;
-		for(const auto &obj : m_objs){
-			obj.calc_intersection(r, isect);
-		}
+		m_bvh.traverse(r, [&](const size_t first, const size_t last, ray &r){
+			float t_max = r.t();
+			const size_t idx = m_spheres.intersect(r.o(), r.d(), t_max, r.t_min(), first, last);
+			if(idx != sphere_array::npos){
+				(m_objs.begin() + idx)->calc_intersection(r, isect);
+			}
+		});
 		return isect;
 	}
 
-	//visibility test
+	//visibility test (any hit)
+	//the object that occluded the previous ray of the calling thread is tested first
 	bool intersect(const ray &r) const
 	{
 		const ray r_(r.o(), r.d(), r.t() * (1 - 1e-3f));
-		for(const auto &obj : m_objs){
-			if(obj.intersect(r_)){
-				return true;
+
+		last_occluder &occluder = find_last_occluder();
+		occlusion_counter &counter = *occluder.p_counter;
+		increment(counter.num_rays);
+
+		if((occluder.idx != no_occluder) && (m_objs.begin() + occluder.idx)->intersect(r_)){
+			increment(counter.num_occluded);
+			increment(counter.num_last_occluder_hits);
+			return true;
+		}
+
+		const bool occluded = m_bvh.intersect(r_, [&](const size_t first, const size_t last){
+			const size_t idx = m_spheres.intersect_any(r_.o(), r_.d(), r_.t(), r_.t_min(), first, last);
+			if(idx != sphere_array::npos){
+				occluder.idx = idx; return true;
 			}
+			return false;
+		});
+		if(occluded){
+			increment(counter.num_occluded);
 		}
-		return false;
+		return occluded;
+	}
+
+	//forget the last occluder of the calling thread
+	//results of visibility tests do not depend on rays traced before, if it is called before each independent task
+	//(e.g., each pixel), since a ray grazing the last occluder can be judged differently from traversal of bvh
+	void reset_last_occluder() const
+	{
+		find_last_occluder().idx = no_occluder;
+	}
+
+	//visibility tests of ray stream (any hit)
+	//rays are sorted by origin and direction, and traced in packets through bvh
+	//i-th bit of occluded (64 rays per word) is set if rays[i] is occluded
+	void intersect(const std::vector<ray> &rays, std::vector<uint64_t> &occluded) const
+	{
+		const size_t n = rays.size();
+		occluded.assign((n + 63) / 64, 0);
+		if(n == 0){
+			return;
+		}
+
+		last_occluder &occluder = find_last_occluder();
+		occlusion_counter &counter = *occluder.p_counter;
+		increment(counter.num_rays, n);
+
+		//sort rays by morton codes of origin and direction
+		//(rays are not sorted if bvh consists of a single leaf, since all rays visit the same node)
+		thread_local std::vector<std::pair<uint64_t, uint32_t>> keys;
+		if(m_bvh.num_nodes() <= 1){
+			keys.resize(n);
+			for(size_t i = 0; i < n; i++){
+				keys[i] = std::make_pair(uint64_t(0), uint32_t(i));
+			}
+		}else{
+			aabb box;
+			for(const auto &r : rays){
+				box.expand(r.o());
+			}
+			const vec3 ext = box.max() - box.min();
+			const vec3 scale(
+				(ext.x > 0) ? 1023 / ext.x : 0, (ext.y > 0) ? 1023 / ext.y : 0, (ext.z > 0) ? 1023 / ext.z : 0
+			);
+
+			keys.resize(n);
+			for(size_t i = 0; i < n; i++){
+				const vec3 o = (rays[i].o() - box.min()) * scale;
+				const vec3 d = (rays[i].d() + vec3(1)) * 511.5f;
+				const uint64_t key_o = morton_code(uint32_t(o.x), uint32_t(o.y), uint32_t(o.z));
+				const uint64_t key_d = morton_code(uint32_t(d.x), uint32_t(d.y), uint32_t(d.z));
+				keys[i] = std::make_pair((key_o << 30) | key_d, uint32_t(i));
+			}
+			std::sort(keys.begin(), keys.end());
+		}
+
+		//trace packets of sorted rays
+		thread_local std::vector<ray> packet;
+		for(size_t base = 0; base < n; base += packet_size){
+
+			const size_t num = std::min(packet_size, n - base);
+			packet.clear();
+			for(size_t i = 0; i < num; i++){
+				const ray &r = rays[keys[base + i].second];
+				packet.emplace_back(r.o(), r.d(), r.t() * (1 - 1e-3f));
+			}
+
+			//test last occluder first
+			uint32_t mask = 0;
+			if(occluder.idx != no_occluder){
+				for(size_t i = 0; i < num; i++){
+					if((m_objs.begin() + occluder.idx)->intersect(packet[i])){
+						mask |= 1u << i;
+					}
+				}
+				increment(counter.num_last_occluder_hits, popcount(mask));
+			}
+
+			const uint32_t active = ((num == 32) ? ~0u : ((1u << num) - 1)) & ~mask;
+			mask |= m_bvh.intersect(packet.data(), active, [&](const size_t first, const size_t last, const int i){
+				const ray &r = packet[i];
+				const size_t idx = m_spheres.intersect_any(r.o(), r.d(), r.t(), r.t_min(), first, last);
+				if(idx != sphere_array::npos){
+					occluder.idx = idx; return true;
+				}
+				return false;
+			});
+			increment(counter.num_occluded, popcount(mask));
+
+			for(; mask; mask &= mask - 1){
+				const uint32_t idx = keys[base + count_trailing_zeros(mask)].second;
+				occluded[idx / 64] |= uint64_t(1) << (idx % 64);
+			}
+		}
+	}
+
+	//counters of visibility tests
+	struct occlusion_stats{
+		size_t num_rays;               //number of visibility tests
+		size_t num_occluded;           //number of occluded rays
+		size_t num_last_occluder_hits; //number of rays occluded by the last occluder of the thread
+	};
+	occlusion_stats calc_occlusion_stats() const
+	{
+		std::lock_guard<std::mutex> lock(m_counter_mtx);
+		occlusion_stats stats = {};
+		for(const auto &counter : m_counters){
+			stats.num_rays += counter->num_rays.load(std::memory_order_relaxed);
+			stats.num_occluded += counter->num_occluded.load(std::memory_order_relaxed);
+			stats.num_last_occluder_hits += counter->num_last_occluder_hits.load(std::memory_order_relaxed);
+		}
+		return stats;
 	}
 
 	//point sampling of light sources in the scene
@@ -64,7 +219,62 @@ public:
 
 private:
 
-	distribution<object> m_objs;
+	//per-thread counters (written only by owner thread)
+	struct occlusion_counter{
+		std::thread::id owner;
+		std::atomic_size_t num_rays;
+		std::atomic_size_t num_occluded;
+		std::atomic_size_t num_last_occluder_hits;
+	};
+
+	//per-thread cache of last occluder
+	struct last_occluder{
+		size_t scene_id; size_t idx; occlusion_counter *p_counter;
+	};
+	static constexpr size_t no_occluder = size_t(-1);
+
+	//number of rays traced together in ray stream
+	static constexpr size_t packet_size = 32;
+
+	static void increment(std::atomic_size_t &n, const size_t k = 1)
+	{
+		n.store(n.load(std::memory_order_relaxed) + k, std::memory_order_relaxed);
+	}
+
+	//return last occluder of calling thread
+	last_occluder &find_last_occluder() const
+	{
+		thread_local last_occluder occluder;
+		if(occluder.scene_id != m_id){
+			occluder = last_occluder{ m_id, no_occluder, &find_counter() };
+		}
+		return occluder;
+	}
+
+	//return counter of calling thread
+	occlusion_counter &find_counter() const
+	{
+		std::lock_guard<std::mutex> lock(m_counter_mtx);
+		const auto id = std::this_thread::get_id();
+		for(auto &counter : m_counters){
+			if(counter->owner == id){
+				return *counter;
+			}
+		}
+		m_counters.push_back(std::make_unique<occlusion_counter>());
+		m_counters.back()->owner = id;
+		return *m_counters.back();
+	}
+
+	distribution<object, alias_table> m_objs;
+	sphere_array m_spheres;
+	bvh m_bvh;
+
+	size_t m_id; //identifier of scene to validate thread_local caches
+	mutable std::mutex m_counter_mtx;
+	mutable std::vector<std::unique_ptr<occlusion_counter>> m_counters;
+
+	static inline std::atomic_size_t s_num_scenes = 0;
 };
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
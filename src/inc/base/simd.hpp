@@ -0,0 +1,132 @@
+#pragma once
+
+#ifndef SIMD_HPP
+#define SIMD_HPP
+
+//runtime detection of SIMD instruction sets
+//kernels for each instruction set are compiled with SIMD_TARGET and selected at runtime,
+//so that the binary runs on CPUs without AVX2/AVX-512
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define SIMD_X86
+#include<immintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#include<intrin.h>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define SIMD_TARGET(isa) __attribute__((target(isa)))
+#else
+#define SIMD_TARGET(isa)
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//simd_isa
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+enum class simd_isa
+{
+	scalar, sse, avx2, avx512
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//function definitions
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+//detect the widest instruction set supported by CPU and OS
+inline simd_isa detect_simd_isa()
+{
+#if defined(SIMD_X86)
+#if defined(_MSC_VER) && !defined(__clang__)
+	int info[4];
+	__cpuid(info, 0);
+	const int max_leaf = info[0];
+
+	__cpuid(info, 1);
+	const bool has_sse2 = (info[3] & (1 << 26)) != 0;
+	const bool has_osxsave = (info[2] & (1 << 27)) != 0;
+	const bool has_avx = (info[2] & (1 << 28)) != 0;
+	const unsigned long long xcr0 = has_osxsave ? _xgetbv(0) : 0;
+
+	bool has_avx2 = false, has_avx512 = false;
+	if(max_leaf >= 7){
+		__cpuidex(info, 7, 0);
+		has_avx2 = has_avx && ((xcr0 & 0x06) == 0x06) && ((info[1] & (1 << 5)) != 0);
+		has_avx512 = has_avx2 && ((xcr0 & 0xe6) == 0xe6) && ((info[1] & (1 << 16)) != 0);
+	}
+	if(has_avx512){
+		return simd_isa::avx512;
+	}else if(has_avx2){
+		return simd_isa::avx2;
+	}else if(has_sse2){
+		return simd_isa::sse;
+	}
+#else
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx512f")){
+		return simd_isa::avx512;
+	}else if(__builtin_cpu_supports("avx2")){
+		return simd_isa::avx2;
+	}else if(__builtin_cpu_supports("sse2")){
+		return simd_isa::sse;
+	}
+#endif
+#endif
+	return simd_isa::scalar;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+//index of the lowest set bit (mask != 0)
+inline int count_trailing_zeros(const unsigned int mask)
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+	unsigned long idx;
+	_BitScanForward(&idx, mask);
+	return int(idx);
+#else
+	return __builtin_ctz(mask);
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+//number of set bits
+inline int popcount(unsigned int mask)
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+	mask = mask - ((mask >> 1) & 0x55555555u);
+	mask = (mask & 0x33333333u) + ((mask >> 2) & 0x33333333u);
+	return int((((mask + (mask >> 4)) & 0x0f0f0f0fu) * 0x01010101u) >> 24);
+#else
+	return __builtin_popcount(mask);
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+//instruction set used by SIMD kernels (detected once)
+inline simd_isa active_simd_isa()
+{
+	static const simd_isa isa = detect_simd_isa();
+	return isa;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+//number of float lanes of isa
+inline int simd_width(const simd_isa isa)
+{
+	switch(isa){
+		case simd_isa::avx512: return 16;
+		case simd_isa::avx2: return 8;
+		case simd_isa::sse: return 4;
+		default: return 1;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif
@@ -6,6 +6,7 @@
 
 #include"ray.hpp"
 #include"rng.hpp"
+#include"aabb.hpp"
 #include"intersection.hpp"
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -96,6 +97,21 @@ public:
 		return 4 * PI() * m_r * m_r;
 	}
 
+	const vec3 &center() const
+	{
+		return m_c;
+	}
+	float radius() const
+	{
+		return m_r;
+	}
+
+	//return bounding box of sphere
+	aabb bounds() const
+	{
+		return aabb(m_c - vec3(m_r), m_c + vec3(m_r));
+	}
+
 private:
 
 	vec3 m_c;
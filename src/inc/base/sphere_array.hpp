@@ -0,0 +1,284 @@
+#pragma once
+
+#ifndef SPHERE_ARRAY_HPP
+#define SPHERE_ARRAY_HPP
+
+#include<vector>
+#include<cstdint>
+
+#include"simd.hpp"
+#include"sphere.hpp"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//sphere_array
+/*/////////////////////////////////////////////////////////////////////////////////////////////////
+structure-of-arrays store of spheres (centers and squared radii only)
+a ray is tested against 4/8/16 spheres at once with SSE/AVX2/AVX-512 kernels selected at runtime
+kernels evaluate the same expressions as sphere::intersect in the same order (up to FMA contraction by compiler)
+/////////////////////////////////////////////////////////////////////////////////////////////////*/
+
+class sphere_array
+{
+public:
+
+	static const size_t npos = size_t(-1);
+
+	//spheres: set of spheres, isa: instruction set of kernels
+	explicit sphere_array(const std::vector<sphere> &spheres, const simd_isa isa = active_simd_isa()) : m_size(spheres.size()), m_isa(isa)
+	{
+		//pad arrays so that the last chunk can be loaded without bounds checks
+		const size_t n = spheres.size() + max_width;
+		m_cx.resize(n); m_cy.resize(n); m_cz.resize(n); m_r2.resize(n);
+		for(size_t i = 0; i < m_size; i++){
+			m_cx[i] = spheres[i].center().x;
+			m_cy[i] = spheres[i].center().y;
+			m_cz[i] = spheres[i].center().z;
+			m_r2[i] = spheres[i].radius() * spheres[i].radius();
+		}
+	}
+	sphere_array() : m_size(), m_isa(simd_isa::scalar)
+	{
+	}
+
+	//closest hit test of ray (o,d) against spheres [first,last)
+	//return index of the closest sphere (npos if no hit), and distance to the sphere is stored in t_max
+	size_t intersect(const vec3 &o, const vec3 &d, float &t_max, const float t_min, const size_t first, const size_t last) const
+	{
+		return dispatch(o, d, t_max, t_min, first, last, false);
+	}
+
+	//any hit test of ray (o,d) against spheres [first,last)
+	//return index of a sphere intersecting the ray (npos if no hit)
+	size_t intersect_any(const vec3 &o, const vec3 &d, float t_max, const float t_min, const size_t first, const size_t last) const
+	{
+		return dispatch(o, d, t_max, t_min, first, last, true);
+	}
+
+	size_t size() const
+	{
+		return m_size;
+	}
+
+	simd_isa isa() const
+	{
+		return m_isa;
+	}
+
+	//number of spheres tested at once
+	int width() const
+	{
+		return simd_width(m_isa);
+	}
+
+private:
+
+	static const size_t max_width = 16;
+
+	size_t dispatch(const vec3 &o, const vec3 &d, float &t_max, const float t_min, const size_t first, const size_t last, const bool any) const
+	{
+		switch(m_isa){
+#if defined(SIMD_X86)
+			case simd_isa::avx512: return intersect_avx512(o, d, t_max, t_min, first, last, any);
+			case simd_isa::avx2:   return intersect_avx2(o, d, t_max, t_min, first, last, any);
+			case simd_isa::sse:    return intersect_sse(o, d, t_max, t_min, first, last, any);
+#endif
+			default:               return intersect_scalar(o, d, t_max, t_min, first, last, any);
+		}
+	}
+
+	//update closest hit using mask of hit lanes and distances t
+	//return true if the search can be terminated (any hit)
+	static bool update(unsigned int mask, const float *t, const size_t base, const size_t last, float &t_max, size_t &idx, const bool any)
+	{
+		//discard lanes beyond last
+		if(last - base < 32){
+			mask &= (1u << (last - base)) - 1;
+		}
+		while(mask){
+			const int lane = count_trailing_zeros(mask);
+			if(t[lane] < t_max){
+				t_max = t[lane]; idx = base + lane;
+				if(any){
+					return true;
+				}
+			}
+			mask &= mask - 1;
+		}
+		return false;
+	}
+
+	size_t intersect_scalar(const vec3 &o, const vec3 &d, float &t_max, const float t_min, const size_t first, const size_t last, const bool any) const
+	{
+		const float A = dot(d, d);
+		const float inv_A = 1 / A;
+
+		size_t idx = npos;
+		for(size_t i = first; i < last; i++){
+
+			const vec3 co(o.x - m_cx[i], o.y - m_cy[i], o.z - m_cz[i]);
+
+			const float B = d.x * co.x + d.y * co.y + d.z * co.z;
+			const float C = (co.x * co.x + co.y * co.y + co.z * co.z) - m_r2[i];
+
+			const float D = B * B - A * C;
+			if(D <= 0){
+				continue;
+			}
+
+			const float sqrt_D = sqrt(D);
+			const float t1 = (-B - sqrt_D) * inv_A;
+			const float t2 = (-B + sqrt_D) * inv_A;
+
+			const float t = (t1 > t_min) ? t1 : t2;
+			if((t > t_min) && update(1, &t, i, last, t_max, idx, any)){
+				break;
+			}
+		}
+		return idx;
+	}
+
+#if defined(SIMD_X86)
+
+	SIMD_TARGET("sse2") size_t intersect_sse(const vec3 &o, const vec3 &d, float &t_max, const float t_min, const size_t first, const size_t last, const bool any) const
+	{
+		const float A = dot(d, d);
+		const __m128 A_ = _mm_set1_ps(A);
+		const __m128 inv_A = _mm_set1_ps(1 / A);
+		const __m128 ox = _mm_set1_ps(o.x), oy = _mm_set1_ps(o.y), oz = _mm_set1_ps(o.z);
+		const __m128 dx = _mm_set1_ps(d.x), dy = _mm_set1_ps(d.y), dz = _mm_set1_ps(d.z);
+		const __m128 t_min_ = _mm_set1_ps(t_min);
+		const __m128 zero = _mm_setzero_ps();
+
+		alignas(16) float t[4];
+		size_t idx = npos;
+		for(size_t i = first; i < last; i += 4){
+
+			const __m128 cox = _mm_sub_ps(ox, _mm_loadu_ps(&m_cx[i]));
+			const __m128 coy = _mm_sub_ps(oy, _mm_loadu_ps(&m_cy[i]));
+			const __m128 coz = _mm_sub_ps(oz, _mm_loadu_ps(&m_cz[i]));
+
+			const __m128 B = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, cox), _mm_mul_ps(dy, coy)), _mm_mul_ps(dz, coz));
+			const __m128 C = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(cox, cox), _mm_mul_ps(coy, coy)), _mm_mul_ps(coz, coz)), _mm_loadu_ps(&m_r2[i]));
+
+			const __m128 D = _mm_sub_ps(_mm_mul_ps(B, B), _mm_mul_ps(A_, C));
+			const __m128 valid = _mm_cmpgt_ps(D, zero);
+			if(_mm_movemask_ps(valid) == 0){
+				continue;
+			}
+
+			const __m128 sqrt_D = _mm_sqrt_ps(D);
+			const __m128 neg_B = _mm_sub_ps(zero, B);
+			const __m128 t1 = _mm_mul_ps(_mm_sub_ps(neg_B, sqrt_D), inv_A);
+			const __m128 t2 = _mm_mul_ps(_mm_add_ps(neg_B, sqrt_D), inv_A);
+
+			const __m128 use_t1 = _mm_cmpgt_ps(t1, t_min_);
+			const __m128 t_ = _mm_or_ps(_mm_and_ps(use_t1, t1), _mm_andnot_ps(use_t1, t2));
+			const __m128 hit = _mm_and_ps(valid, _mm_cmpgt_ps(t_, t_min_));
+
+			_mm_store_ps(t, t_);
+			if(update(unsigned(_mm_movemask_ps(hit)), t, i, last, t_max, idx, any)){
+				break;
+			}
+		}
+		return idx;
+	}
+
+	SIMD_TARGET("avx2") size_t intersect_avx2(const vec3 &o, const vec3 &d, float &t_max, const float t_min, const size_t first, const size_t last, const bool any) const
+	{
+		const float A = dot(d, d);
+		const __m256 A_ = _mm256_set1_ps(A);
+		const __m256 inv_A = _mm256_set1_ps(1 / A);
+		const __m256 ox = _mm256_set1_ps(o.x), oy = _mm256_set1_ps(o.y), oz = _mm256_set1_ps(o.z);
+		const __m256 dx = _mm256_set1_ps(d.x), dy = _mm256_set1_ps(d.y), dz = _mm256_set1_ps(d.z);
+		const __m256 t_min_ = _mm256_set1_ps(t_min);
+		const __m256 zero = _mm256_setzero_ps();
+
+		alignas(32) float t[8];
+		size_t idx = npos;
+		for(size_t i = first; i < last; i += 8){
+
+			const __m256 cox = _mm256_sub_ps(ox, _mm256_loadu_ps(&m_cx[i]));
+			const __m256 coy = _mm256_sub_ps(oy, _mm256_loadu_ps(&m_cy[i]));
+			const __m256 coz = _mm256_sub_ps(oz, _mm256_loadu_ps(&m_cz[i]));
+
+			const __m256 B = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, cox), _mm256_mul_ps(dy, coy)), _mm256_mul_ps(dz, coz));
+			const __m256 C = _mm256_sub_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(cox, cox), _mm256_mul_ps(coy, coy)), _mm256_mul_ps(coz, coz)), _mm256_loadu_ps(&m_r2[i]));
+
+			const __m256 D = _mm256_sub_ps(_mm256_mul_ps(B, B), _mm256_mul_ps(A_, C));
+			const __m256 valid = _mm256_cmp_ps(D, zero, _CMP_GT_OQ);
+			if(_mm256_movemask_ps(valid) == 0){
+				continue;
+			}
+
+			const __m256 sqrt_D = _mm256_sqrt_ps(D);
+			const __m256 neg_B = _mm256_sub_ps(zero, B);
+			const __m256 t1 = _mm256_mul_ps(_mm256_sub_ps(neg_B, sqrt_D), inv_A);
+			const __m256 t2 = _mm256_mul_ps(_mm256_add_ps(neg_B, sqrt_D), inv_A);
+
+			const __m256 t_ = _mm256_blendv_ps(t2, t1, _mm256_cmp_ps(t1, t_min_, _CMP_GT_OQ));
+			const __m256 hit = _mm256_and_ps(valid, _mm256_cmp_ps(t_, t_min_, _CMP_GT_OQ));
+
+			_mm256_store_ps(t, t_);
+			if(update(unsigned(_mm256_movemask_ps(hit)), t, i, last, t_max, idx, any)){
+				break;
+			}
+		}
+		return idx;
+	}
+
+	SIMD_TARGET("avx512f") size_t intersect_avx512(const vec3 &o, const vec3 &d, float &t_max, const float t_min, const size_t first, const size_t last, const bool any) const
+	{
+		const float A = dot(d, d);
+		const __m512 A_ = _mm512_set1_ps(A);
+		const __m512 inv_A = _mm512_set1_ps(1 / A);
+		const __m512 ox = _mm512_set1_ps(o.x), oy = _mm512_set1_ps(o.y), oz = _mm512_set1_ps(o.z);
+		const __m512 dx = _mm512_set1_ps(d.x), dy = _mm512_set1_ps(d.y), dz = _mm512_set1_ps(d.z);
+		const __m512 t_min_ = _mm512_set1_ps(t_min);
+		const __m512 zero = _mm512_setzero_ps();
+
+		alignas(64) float t[16];
+		size_t idx = npos;
+		for(size_t i = first; i < last; i += 16){
+
+			const __m512 cox = _mm512_sub_ps(ox, _mm512_loadu_ps(&m_cx[i]));
+			const __m512 coy = _mm512_sub_ps(oy, _mm512_loadu_ps(&m_cy[i]));
+			const __m512 coz = _mm512_sub_ps(oz, _mm512_loadu_ps(&m_cz[i]));
+
+			const __m512 B = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(dx, cox), _mm512_mul_ps(dy, coy)), _mm512_mul_ps(dz, coz));
+			const __m512 C = _mm512_sub_ps(_mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(cox, cox), _mm512_mul_ps(coy, coy)), _mm512_mul_ps(coz, coz)), _mm512_loadu_ps(&m_r2[i]));
+
+			const __m512 D = _mm512_sub_ps(_mm512_mul_ps(B, B), _mm512_mul_ps(A_, C));
+			const __mmask16 valid = _mm512_cmp_ps_mask(D, zero, _CMP_GT_OQ);
+			if(valid == 0){
+				continue;
+			}
+
+			const __m512 sqrt_D = _mm512_sqrt_ps(D);
+			const __m512 neg_B = _mm512_sub_ps(zero, B);
+			const __m512 t1 = _mm512_mul_ps(_mm512_sub_ps(neg_B, sqrt_D), inv_A);
+			const __m512 t2 = _mm512_mul_ps(_mm512_add_ps(neg_B, sqrt_D), inv_A);
+
+			const __m512 t_ = _mm512_mask_blend_ps(_mm512_cmp_ps_mask(t1, t_min_, _CMP_GT_OQ), t2, t1);
+			const __mmask16 hit = valid & _mm512_cmp_ps_mask(t_, t_min_, _CMP_GT_OQ);
+
+			_mm512_store_ps(t, t_);
+			if(update(unsigned(hit), t, i, last, t_max, idx, any)){
+				break;
+			}
+		}
+		return idx;
+	}
+
+#endif
+
+	std::vector<float> m_cx;
+	std::vector<float> m_cy;
+	std::vector<float> m_cz;
+	std::vector<float> m_r2;
+	size_t m_size;
+	simd_isa m_isa;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif
@@ -0,0 +1,122 @@
+#pragma once
+
+#ifndef SPLAT_BUFFER_HPP
+#define SPLAT_BUFFER_HPP
+
+#include<cmath>
+#include<vector>
+#include<atomic>
+#include<memory>
+#include<cstdint>
+#include<algorithm>
+
+#include"math.hpp"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//splat_buffer
+/*/////////////////////////////////////////////////////////////////////////////////////////////////
+image buffer to which threads add colors at arbitrary pixels (e.g., light tracing) without locks
+per_thread: each thread adds to its own image and images are summed by take (no atomics)
+atomic    : all threads add to one image by atomic fetch_add
+per_thread is used if images of all threads fit in max_bytes, since it reads nt images per pixel in take
+colors are accumulated in 64-bit fixed point (2^-28 precision), so that the sum is exact and does not depend on
+the order of additions (i.e., which threads add which colors)
+/////////////////////////////////////////////////////////////////////////////////////////////////*/
+
+class splat_buffer
+{
+public:
+
+	enum class mode{
+		per_thread, atomic
+	};
+
+	//width, height: resolution, nt: number of threads calling add (thread index is in [0,nt))
+	splat_buffer(const int width, const int height, const size_t nt, const size_t max_bytes = 64 << 20) : m_width(width), m_height(height), m_nt(std::max<size_t>(nt, 1))
+	{
+		const size_t n = 3 * size_t(width) * height;
+		m_mode = ((m_nt == 1) || (m_nt * n * sizeof(int64_t) <= max_bytes)) ? mode::per_thread : mode::atomic;
+
+		if(m_mode == mode::per_thread){
+			//images are padded to cache line to avoid false sharing
+			m_stride = (n + 7) / 8 * 8;
+			m_bufs.assign(m_nt * m_stride, 0);
+		}else{
+			m_stride = n;
+			m_atomic_buf = std::make_unique<std::atomic<int64_t>[]>(n);
+			for(size_t i = 0; i < n; i++){
+				m_atomic_buf[i].store(0, std::memory_order_relaxed);
+			}
+		}
+	}
+	splat_buffer() : m_width(), m_height(), m_nt(), m_stride(), m_mode(mode::per_thread)
+	{
+	}
+
+	//add col to pixel (x,y) by tid-th thread
+	void add(const int x, const int y, const col3 &col, const size_t tid)
+	{
+		const size_t idx = 3 * (x + size_t(m_width) * y);
+		const int64_t val[3] = { to_fixed(col[0]), to_fixed(col[1]), to_fixed(col[2]) };
+		if(m_mode == mode::per_thread){
+			int64_t *p = &m_bufs[tid * m_stride + idx];
+			p[0] += val[0]; p[1] += val[1]; p[2] += val[2];
+		}else{
+			for(int i = 0; i < 3; i++){
+				m_atomic_buf[idx + i].fetch_add(val[i], std::memory_order_relaxed);
+			}
+		}
+	}
+
+	//return sum of colors added to pixel (x,y) and reset it to zero
+	//take must not be called concurrently with add (different pixels can be taken in parallel)
+	col3 take(const int x, const int y)
+	{
+		const size_t idx = 3 * (x + size_t(m_width) * y);
+		int64_t sum[3] = {};
+		if(m_mode == mode::per_thread){
+			for(size_t t = 0; t < m_nt; t++){
+				int64_t *p = &m_bufs[t * m_stride + idx];
+				sum[0] += p[0]; sum[1] += p[1]; sum[2] += p[2];
+				p[0] = p[1] = p[2] = 0;
+			}
+		}else{
+			for(int i = 0; i < 3; i++){
+				sum[i] = m_atomic_buf[idx + i].exchange(0, std::memory_order_relaxed);
+			}
+		}
+		return col3(float(sum[0] * fixed_to_float), float(sum[1] * fixed_to_float), float(sum[2] * fixed_to_float));
+	}
+
+	mode strategy() const
+	{
+		return m_mode;
+	}
+
+private:
+
+	//scale of fixed point numbers (sum up to 2^35 is representable)
+	static constexpr double float_to_fixed = double(1 << 28);
+	static constexpr double fixed_to_float = 1 / float_to_fixed;
+	static constexpr double max_value = double(int64_t(1) << 30);
+
+	//NaN is discarded and values are clamped to avoid overflow
+	static int64_t to_fixed(const float val)
+	{
+		return std::isnan(val) ? 0 : int64_t(std::llround(std::min(std::max(double(val), -max_value), max_value) * float_to_fixed));
+	}
+
+private:
+
+	int m_width;
+	int m_height;
+	size_t m_nt;
+	size_t m_stride; //number of int64_t (fixed-point values) per image in m_bufs
+	mode m_mode;
+	std::vector<int64_t> m_bufs; //images of threads (per_thread)
+	std::unique_ptr<std::atomic<int64_t>[]> m_atomic_buf; //shared image (atomic)
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif
@@ -0,0 +1,203 @@
+#pragma once
+
+#ifndef TONEMAP_HPP
+#define TONEMAP_HPP
+
+#include<cmath>
+#include<cstring>
+#include<cstdint>
+#include<algorithm>
+
+#include"math.hpp"
+#include"simd.hpp"
+#include"image.hpp"
+#include"parallel.hpp"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//tonemap
+/*/////////////////////////////////////////////////////////////////////////////////////////////////
+conversion of accumulated radiance into 8-bit image with gamma correction
+each value is converted into (unsigned char)(clamp(pow(float(sum/divisor), 1/gamma), 0, 1) * 255)
+instead of evaluating pow for each value, the smallest float mapped to each of 1..255 is found once by bisection,
+and values are converted by search over these 255 thresholds (4/8/16 values at once with SSE/AVX2/AVX-512):
+upper 4 bits of result are found by comparison with 15 thresholds in registers, and lower 4 bits by binary search with gathers,
+so that results are identical to the scalar expression regardless of instruction set
+rows are converted in parallel by threads of given pool (e.g., that of renderer)
+/////////////////////////////////////////////////////////////////////////////////////////////////*/
+
+class tonemap
+{
+public:
+
+	//gamma: gamma of display
+	explicit tonemap(const float gamma = 2.2f, const simd_isa isa = active_simd_isa()) : m_isa(isa)
+	{
+		const float inv_gamma = 1.0f / gamma;
+		auto convert = [inv_gamma](const float val){
+			return int((unsigned char)(clamp(std::pow(val, inv_gamma), 0, 1) * 255));
+		};
+
+		//bit patterns of non-negative floats are ordered as integers
+		m_thresholds[0] = -FLT_MAX;
+		for(int v = 1; v < 256; v++){
+			uint32_t lo = 0, hi = 0x3f800000; //[0,1]
+			while(lo < hi){
+				const uint32_t mid = lo + (hi - lo) / 2;
+				float val; std::memcpy(&val, &mid, 4);
+				if(convert(val) >= v){
+					hi = mid;
+				}else{
+					lo = mid + 1;
+				}
+			}
+			std::memcpy(&m_thresholds[v], &lo, 4);
+		}
+	}
+
+	//convert sum/divisor into dst (dst must have the same resolution as sum) with threads of pool
+	void operator()(const imaged &sum, const double divisor, image &dst, thread_pool &pool) const
+	{
+		const int w = sum.width();
+		in_parallel(sum.height(), [&](const int y)
+		{
+			convert_row(sum(0, y), divisor, dst(0, y), 3 * size_t(w));
+		}, pool);
+	}
+
+private:
+
+	//convert n values of src into dst
+	void convert_row(const double *src, const double divisor, unsigned char *dst, const size_t n) const
+	{
+		size_t first = 0;
+		switch(m_isa){
+#if defined(SIMD_X86)
+			case simd_isa::avx512: first = convert_avx512(src, divisor, dst, n); break;
+			case simd_isa::avx2:   first = convert_avx2(src, divisor, dst, n); break;
+			case simd_isa::sse:    first = convert_sse(src, divisor, dst, n); break;
+#endif
+			default:               break;
+		}
+
+		//remainder of chunks
+		convert_scalar(src, divisor, dst, first, n);
+	}
+
+	//kernels convert values [first,n) in chunks and return index of the first value not converted
+	void convert_scalar(const double *src, const double divisor, unsigned char *dst, const size_t first, const size_t n) const
+	{
+		for(size_t i = first; i < n; i++){
+			const float val = float(src[i] / divisor);
+			int idx = 0;
+			for(int step = 128; step > 0; step /= 2){
+				idx += (m_thresholds[idx + step] <= val) ? step : 0;
+			}
+			dst[i] = (unsigned char)idx;
+		}
+	}
+
+#if defined(SIMD_X86)
+
+	SIMD_TARGET("sse2") size_t convert_sse(const double *src, const double divisor, unsigned char *dst, const size_t n) const
+	{
+		const __m128d d = _mm_set1_pd(divisor);
+
+		size_t i = 0;
+		for(; i + 4 <= n; i += 4){
+
+			const __m128 lo = _mm_cvtpd_ps(_mm_div_pd(_mm_loadu_pd(&src[i + 0]), d));
+			const __m128 hi = _mm_cvtpd_ps(_mm_div_pd(_mm_loadu_pd(&src[i + 2]), d));
+			const __m128 val = _mm_movelh_ps(lo, hi);
+
+			//upper 4 bits (number of thresholds 16,32,...,240 not greater than val)
+			__m128i idx = _mm_setzero_si128();
+			for(int v = 16; v < 256; v += 16){
+				idx = _mm_sub_epi32(idx, _mm_castps_si128(_mm_cmple_ps(_mm_set1_ps(m_thresholds[v]), val)));
+			}
+			idx = _mm_slli_epi32(idx, 4);
+
+			//lower 4 bits (SSE2 has no gather, so that thresholds are loaded one by one)
+			for(int step = 8; step > 0; step /= 2){
+				alignas(16) int32_t k[4];
+				_mm_store_si128(reinterpret_cast<__m128i*>(k), _mm_add_epi32(idx, _mm_set1_epi32(step)));
+				const __m128 t = _mm_setr_ps(m_thresholds[k[0]], m_thresholds[k[1]], m_thresholds[k[2]], m_thresholds[k[3]]);
+				idx = _mm_add_epi32(idx, _mm_and_si128(_mm_castps_si128(_mm_cmple_ps(t, val)), _mm_set1_epi32(step)));
+			}
+
+			const __m128i bytes = _mm_packus_epi16(_mm_packs_epi32(idx, idx), _mm_setzero_si128());
+			const int32_t packed = _mm_cvtsi128_si32(bytes);
+			std::memcpy(&dst[i], &packed, 4);
+		}
+		return i;
+	}
+
+	SIMD_TARGET("avx2") size_t convert_avx2(const double *src, const double divisor, unsigned char *dst, const size_t n) const
+	{
+		const __m256d d = _mm256_set1_pd(divisor);
+
+		size_t i = 0;
+		for(; i + 8 <= n; i += 8){
+
+			const __m128 lo = _mm256_cvtpd_ps(_mm256_div_pd(_mm256_loadu_pd(&src[i + 0]), d));
+			const __m128 hi = _mm256_cvtpd_ps(_mm256_div_pd(_mm256_loadu_pd(&src[i + 4]), d));
+			const __m256 val = _mm256_insertf128_ps(_mm256_castps128_ps256(lo), hi, 1);
+
+			//upper 4 bits (number of thresholds 16,32,...,240 not greater than val)
+			__m256i idx = _mm256_setzero_si256();
+			for(int v = 16; v < 256; v += 16){
+				idx = _mm256_sub_epi32(idx, _mm256_castps_si256(_mm256_cmp_ps(_mm256_set1_ps(m_thresholds[v]), val, _CMP_LE_OQ)));
+			}
+			idx = _mm256_slli_epi32(idx, 4);
+
+			//lower 4 bits
+			for(int step = 8; step > 0; step /= 2){
+				const __m256 t = _mm256_i32gather_ps(m_thresholds, _mm256_add_epi32(idx, _mm256_set1_epi32(step)), 4);
+				idx = _mm256_add_epi32(idx, _mm256_and_si256(_mm256_castps_si256(_mm256_cmp_ps(t, val, _CMP_LE_OQ)), _mm256_set1_epi32(step)));
+			}
+
+			const __m128i words = _mm_packs_epi32(_mm256_castsi256_si128(idx), _mm256_extracti128_si256(idx, 1));
+			_mm_storel_epi64(reinterpret_cast<__m128i*>(&dst[i]), _mm_packus_epi16(words, words));
+		}
+		return i;
+	}
+
+	SIMD_TARGET("avx512f") size_t convert_avx512(const double *src, const double divisor, unsigned char *dst, const size_t n) const
+	{
+		const __m512d d = _mm512_set1_pd(divisor);
+
+		size_t i = 0;
+		for(; i + 16 <= n; i += 16){
+
+			const __m256 lo = _mm512_cvtpd_ps(_mm512_div_pd(_mm512_loadu_pd(&src[i + 0]), d));
+			const __m256 hi = _mm512_cvtpd_ps(_mm512_div_pd(_mm512_loadu_pd(&src[i + 8]), d));
+			const __m512 val = _mm512_castpd_ps(_mm512_insertf64x4(_mm512_castpd256_pd512(_mm256_castps_pd(lo)), _mm256_castps_pd(hi), 1));
+
+			//upper 4 bits (number of thresholds 16,32,...,240 not greater than val)
+			__m512i idx = _mm512_setzero_si512();
+			for(int v = 16; v < 256; v += 16){
+				idx = _mm512_mask_add_epi32(idx, _mm512_cmp_ps_mask(_mm512_set1_ps(m_thresholds[v]), val, _CMP_LE_OQ), idx, _mm512_set1_epi32(1));
+			}
+			idx = _mm512_slli_epi32(idx, 4);
+
+			//lower 4 bits
+			for(int step = 8; step > 0; step /= 2){
+				const __m512i k = _mm512_add_epi32(idx, _mm512_set1_epi32(step));
+				const __m512 t = _mm512_i32gather_ps(k, m_thresholds, 4);
+				idx = _mm512_mask_mov_epi32(idx, _mm512_cmp_ps_mask(t, val, _CMP_LE_OQ), k);
+			}
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(&dst[i]), _mm512_cvtepi32_epi8(idx));
+		}
+		return i;
+	}
+
+#endif
+
+private:
+
+	float m_thresholds[256]; //m_thresholds[v]: smallest value converted into v (v>0)
+	simd_isa m_isa;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif
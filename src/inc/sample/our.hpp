@@ -4,6 +4,9 @@
 #ifndef OUR_HPP
 #define OUR_HPP
 
+#include<chrono>
+#include<memory>
+#include<cstring>
 #include"our/path.hpp"
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -20,13 +23,61 @@ class renderer
 public:
 
 	//constructor ( M : number of pre-sampled light sub-paths, nt : number of threads )
-	renderer(const scene &scene, const camera &camera, const size_t M, const size_t nt = std::thread::hardware_concurrency());
+	//tile_size : size of tiles scheduled to threads in radiance calculation (tile_size_for_gen_caches : in generation of cache points)
+	//seed : seed of random numbers (images are identical for the same seed regardless of nt and tile sizes)
+	//num_light_paths : number of light sub-paths per iteration shared by all pixels (0: widthxheight, at least M)
+	renderer(const scene &scene, const camera &camera, const size_t M, const size_t nt = std::thread::hardware_concurrency(), const int tile_size = 16, const int tile_size_for_gen_caches = 4, const uint64_t seed = 0, const size_t num_light_paths = 0);
 
-	//rendering
+	//rendering (return image of current iteration)
 	imagef render(const scene &scene, const camera &camera);
 
+	//rendering (add image of current iteration to accum, e.g., imagef or imaged with resolution of camera)
+	//no image is allocated, and contributions are added in parallel radiance calculation
+	template<class T> void render_into(const scene &scene, const camera &camera, Image<T> &accum);
+
+	//return persistent threads of renderer (e.g., for tonemap of accumulated images)
+	thread_pool &pool()
+	{
+		return m_pool;
+	}
+
+	//statistics of q*/p in resampling pmfs (accumulated over iterations)
+	struct memo_stats{
+		size_t num_weights;   //number of q*/p of all cache points
+		size_t num_memo_hits; //number of q*/p > 0 reused from light_path::construct without shadow rays
+	};
+	memo_stats calc_memo_stats() const
+	{
+		return m_memo_stats;
+	}
+
+	//wall time [s] of each phase of render (accumulated over iterations)
+	struct phase_times{
+		double gen_caches;         //generation of cache points and their spatial index (cache_index)
+		double gen_light_paths;    //generation of light sub-paths and candidates
+		double calc_distributions; //construction of resampling pmfs at cache points
+		double radiance;           //eye sub-paths and all strategies
+		double splat;              //accumulation of light tracing contributions
+	};
+	phase_times calc_phase_times() const
+	{
+		return m_phase_times;
+	}
+
 private:
 
+	//return stream of random numbers for idx-th pixel/path of phase
+	static uint64_t rng_stream(const uint64_t phase, const uint64_t idx)
+	{
+		return (phase << 32) | idx;
+	}
+
+	//return index of samples of streams in current iteration
+	uint32_t sample_index() const
+	{
+		return uint32_t(m_ite - 1);
+	}
+
 	//calculate radiance for pixel (x,y)
 	col3 radiance(const int x, const int y, const scene &scene, const camera &camera, random_number_generator &rng);
 
@@ -43,15 +94,30 @@ private:
 
 	size_t m_M;
 	size_t m_nt;
-	size_t m_ns1; //number of samples for strategy (s>=1,t=1), i.e., widthxheight of the image
+	thread_pool m_pool; //persistent threads shared by all parallel loops in render
+	int m_tile_size;
+	int m_tile_size_for_gen_caches;
+	uint64_t m_seed;
+	size_t m_ns1; //number of samples for strategy (s>=1,t=1), i.e., number of light sub-paths per iteration
 	float m_Qp;   //normalization factor for virtual cache point (uniform distribution) in Sec. 5.2
 	double m_sum; //sum of Qp for each iteration
 	double m_ite; //number of iterations
-	imagef m_buf_s1; //buffer to store contributions of strategy (s>=1,t=1) (i.e., light tracing)
-	kd_tree<cache> m_caches; //cache points. we store cache points in the previous iteration to calculate the normalization factor Q
-	std::unique_ptr<spinlock[]> m_locks; //spinlock for exclusive access to m_buf_s1
-	std::vector<candidate> m_candidates; //pre-sampled light sub-paths ¥hat{Y} for resampling
-	std::vector<light_path> m_light_paths; //light sub-paths for strategies handled by BPT
+	splat_buffer m_buf_s1; //buffer to store contributions of strategy (s>=1,t=1) (i.e., light tracing)
+	cache_index m_caches; //cache points. we store cache points in the previous iteration to calculate the normalization factor Q
+	std::vector<candidate> m_candidates; //pre-sampled light sub-paths ¥hat{Y} for resampling (shared by resampling pmfs of all cache points)
+	candidate_array m_candidate_array; //snapshot of m_candidates to construct resampling pmfs
+	std::vector<light_path> m_light_paths; //light sub-paths for strategies handled by BPT (m_ns1 paths independent of resolution)
+	std::vector<light_path_arena> m_light_path_arenas; //vertices of light sub-paths generated by each thread
+	std::vector<size_t> m_query_offsets; //index of queries of y(1) of each light sub-path in m_query_points
+	std::vector<vec3> m_query_points; //positions of vertices y(1),y(2),... of all light sub-paths to search neighbor cache points
+	std::vector<std::array<neighbor<cache>, Nc>> m_neighbors; //neighbor cache points of m_query_points
+	std::vector<std::vector<cache>> m_cache_buffers; //cache points generated by each thread
+	struct cache_run{
+		uint32_t tid; uint32_t first; uint32_t count;
+	};
+	std::vector<cache_run> m_cache_runs; //cache points of each pixel in m_cache_buffers
+	memo_stats m_memo_stats;
+	phase_times m_phase_times;
 };
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
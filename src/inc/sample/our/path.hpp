@@ -24,6 +24,35 @@ const float G_max = 1e6f;
 //clamping parameter epsilon in Sec. 5.1
 const float mis_threshold = 1e-3f;
 
+//visibility V in q*/p at cache points
+//if true, q*/p (i.e., resampling pmfs, Q and MIS weights) are calculated without V at cache points,
+//and visibility is resolved only for resampled light sub-paths when they are connected to eye sub-paths
+const bool deferred_visibility = false;
+
+//dimensions of samples drawn by random_number_generator
+//samples for the same purpose (e.g., k-th bounce) use the same dimensions in every iteration, so that low discrepancy samplers stratify them
+//eye sub-path: [0,4) for lens and pixel, light sub-path: [0,6) for light source and emission
+//k-th bounce of both sub-paths: [8+4k,11+4k) for direction and russian roulette
+//resampling at t-th vertex of eye sub-path: [resampling_dimension+4t, resampling_dimension+4t+2)
+const uint64_t emission_dimension = 4;
+const uint64_t resampling_dimension = uint64_t(1) << 20;
+inline uint64_t bounce_dimension(const size_t k)
+{
+	//k must be the number of bounces before (e.g., k=size_t(-1) would wrap around into dimensions of emission)
+	assert(k < (resampling_dimension - 8) / 4);
+	return 8 + 4 * uint64_t(k);
+}
+static_assert(emission_dimension + 2 <= 8, "dimensions of emission must not overlap those of bounces");
+
+//resampling pmf of cache point (index_distribution or alias_table)
+//pmf of cache point is constructed over all candidates every iteration but sampled only a few times,
+//so that cheaper construction and 1/3 of memory of index_distribution outweigh O(1) sampling of alias_table
+using cache_distribution = index_distribution;
+
+//spatial index of cache points to search Nc nearest cache points (kd_tree or hash_grid)
+//hash_grid answers queries by a few cells around query points, while kd_tree does not depend on distribution of cache points
+using cache_index = kd_tree<cache>;
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 //forward declaration
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -31,6 +60,17 @@ const float mis_threshold = 1e-3f;
 class light_path;
 class camera_path;
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//light_path_arena
+/*/////////////////////////////////////////////////////////////////////////////////////////////////
+storage of vertices of light sub-paths generated in an iteration
+each light_path refers to a contiguous range of an arena (offset+length) instead of owning vertices,
+so that vertices of a path are adjacent in memory and no heap allocation occurs once capacity reaches the steady state
+arena is cleared (capacity is kept) at the beginning of every iteration, which invalidates paths constructed on it
+/////////////////////////////////////////////////////////////////////////////////////////////////*/
+
+using light_path_arena = std::vector<light_path_vertex>;
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 //light_path
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -39,10 +79,22 @@ class light_path
 {
 public:
 
-	void construct(const scene &scene, random_number_generator &rng, const kd_tree<cache> &caches);
+	//vertices are appended to arena (arena must not be modified by others until construct returns)
+	//find_neighbor_caches: if false, neighbor cache points are not searched and set_neighbor_caches must be called (e.g., after batch queries)
+	void construct(const scene &scene, random_number_generator &rng, const cache_index &caches, light_path_arena &arena, const bool find_neighbor_caches = true);
+
+	//neighbors: Nc nearest cache points of y(i) in neighbors[i-1] (i=1,2,...,num_vertices()-1)
+	//set neighbor cache points and precompute variables for MIS weights (neighbor_cache and mis_partial_weight are available after it)
+	void set_neighbor_caches(const scene &scene, const std::array<neighbor<cache>, Nc> *neighbors);
 
-	//zi : z(i), zip1: z(i+1), FGVc: array to store F(brdf)*GV at neighbor cache points of z(i)
-	static std::tuple<float, float, col3> pdfs_FG(const scene &scene, const camera_path_vertex &zi, const camera_path_vertex &zip1, std::array<col3, Nc> &FGVc);
+	//return number of vertices y(1),y(2),... whose neighbor cache points are searched
+	size_t num_queries() const
+	{
+		return std::max<size_t>(num_vertices(), 1) - 1;
+	}
+
+	//z: eye sub-path, i: index of z(i) (pdfs of z(i) from z(i+1)), FGVc: array to store F(brdf)*GV at neighbor cache points of z(i)
+	static std::tuple<float, float, col3> pdfs_FG(const scene &scene, const camera_path &z, const size_t i, std::array<col3, Nc> &FGVc);
 
 	//return sampling pdf of z(i) from z(i+1) (n: z(i) is n-th vertex from light source)
 	static float pdf(const camera_path_vertex &zi, const camera_path_vertex &zip1, const size_t n);
@@ -50,8 +102,8 @@ public:
 	//ztm1: z(t-1), ysm1: y(s-1), n: z(t-1) is n-th vertex from light source, zy: direction from z(t-1) to y(s-1), yz: direction from y(s-1) to z(t-1)
 	static std::tuple<float, col3> pdf_FG(const camera_path_vertex &ztm1, const light_path_vertex &ysm1, const size_t n, const direction &zy, const direction &yz);
 
-	//ztm2: z(t-2), ztm1: z(t-1), n: z(t-2) is n-th vertex from light source, zy: direction from z(t-1) to y(s-1), FGVc: array to store FGV
-	static std::tuple<float, col3> pdf_FG(const scene &scene, const camera_path_vertex &ztm2, const camera_path_vertex &ztm1, const size_t n, const direction &zy, std::array<col3, Nc> &FGVc);
+	//z: eye sub-path, t: number of vertices of z used (pdf of z(t-2) from z(t-1)), n: z(t-2) is n-th vertex from light source, zy: direction from z(t-1) to y(s-1), FGVc: array to store FGV
+	static std::tuple<float, col3> pdf_FG(const scene &scene, const camera_path &z, const size_t t, const size_t n, const direction &zy, std::array<col3, Nc> &FGVc);
 
 	//return MIS partial weight (yz : direction from y(s-1) to z(t-1), zy: direction from z(t-1) to y(s-1), Qp : normalization factor for virtual cache point)
 	static float mis_partial_weight(const light_path &y, const size_t s, const camera_path &z, const size_t t, const direction &yz, const direction &zy, const float M, const float Qp);
@@ -59,22 +111,43 @@ public:
 	//return number of vertices
 	size_t num_vertices() const
 	{
-		return m_vertices.size() - 1; //decrement to exclude dummy vertex
+		return m_size - 1; //decrement to exclude dummy vertex
 	}
 
 	//return path vertex
 	light_path_vertex &operator()(const size_t i)
 	{
-		return m_vertices[i + 1]; //increment to exclude dummy vertex
+		return (*mp_arena)[m_offset + (i + 1)]; //increment to exclude dummy vertex
 	}
 	const light_path_vertex &operator()(const size_t i) const
 	{
-		return m_vertices[i + 1];
+		return (*mp_arena)[m_offset + (i + 1)];
+	}
+
+	//return j-th nearest cache point of i-th vertex
+	const cache &neighbor_cache(const size_t i, const size_t j) const
+	{
+		return (*mp_caches)[operator()(i).neighbor_cache_index(j)];
+	}
+
+	light_path() : mp_arena(), m_offset(), m_size(), mp_caches()
+	{
 	}
 
 private:
 
-	std::vector<light_path_vertex> m_vertices;
+	//append vertex to the end of range in arena
+	template<class... Args> void add_vertex(Args&&... args)
+	{
+		mp_arena->emplace_back(std::forward<Args>(args)...); m_size++;
+	}
+
+private:
+
+	light_path_arena *mp_arena; //arena storing vertices (including dummy vertex)
+	size_t m_offset;            //index of dummy vertex in arena
+	size_t m_size;              //number of vertices in arena (including dummy vertex)
+	const cache_index *mp_caches; //cache points referred by indices in vertices
 };
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -89,7 +162,7 @@ public:
 	void construct(const scene &scene, const camera &camera, const int x, const int y, random_number_generator &rng);
 
 	//x,y: pixel coordinate, caches: cache points
-	void construct(const scene &scene, const camera &camera, const int x, const int y, random_number_generator &rng, const kd_tree<cache> &caches);
+	void construct(const scene &scene, const camera &camera, const int x, const int y, random_number_generator &rng, const cache_index &caches);
 
 	//return sampling pdfs (with RR and without RR) of y(i) from y(i+1)
 	static std::tuple<float, float> pdfs(const light_path_vertex &yi, const light_path_vertex &yip1);
@@ -104,7 +177,8 @@ public:
 	static float pdf(const light_path_vertex &ysm2, const light_path_vertex &ysm1, const size_t n, const direction &yz);
 
 	//return MIS partial weight (yz/zy directions from y(s-1)/z(t-1) to z(t-1)/y(s-1), Qp: normalization factor for virtual cache point)
-	static float mis_partial_weight(const scene &scene, const light_path &y, const size_t s, const camera_path &z, const size_t t, const direction &yz, const direction &zy, const float M, const float Qp);
+	//ns1: number of samples for strategies (s>=1,t=1) (i.e., number of light sub-paths per iteration)
+	static float mis_partial_weight(const scene &scene, const light_path &y, const size_t s, const camera_path &z, const size_t t, const direction &yz, const direction &zy, const float M, const float Qp, const float ns1);
 
 	size_t num_vertices() const
 	{
@@ -121,10 +195,20 @@ public:
 		return m_vertices[i];
 	}
 
+	//return j-th nearest cache point of i-th vertex
+	const cache &neighbor_cache(const size_t i, const size_t j) const
+	{
+		return (*mp_caches)[m_vertices[i].neighbor_cache_index(j)];
+	}
+
+	camera_path() : mp_caches()
+	{
+	}
+
 private:
 
-	size_t m_ns1; //number of samples for strategies (s>=1,t=1) (i.e., widthxheight)
 	std::vector<camera_path_vertex> m_vertices;
+	const cache_index *mp_caches; //cache points referred by indices in vertices
 };
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -162,23 +246,98 @@ private:
 	size_t m_i;
 };
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//candidate_array
+/*/////////////////////////////////////////////////////////////////////////////////////////////////
+structure-of-arrays snapshot of candidates constructed once per iteration
+only position, normal and luminance of Le_throughput*F (F of diffuse BRDF is constant) are stored,
+so that resampling weights without V at a cache point are calculated for 4/8/16 candidates at once with SSE/AVX2/AVX-512 kernels
+resampling weights (including V) memoized in light_path::construct are also stored for reuse
+/////////////////////////////////////////////////////////////////////////////////////////////////*/
+
+class candidate_array
+{
+public:
+
+	//candidates: pre-sampled light sub-paths, isa: instruction set of kernels
+	explicit candidate_array(const std::vector<candidate> &candidates, const simd_isa isa = active_simd_isa());
+	candidate_array() : m_isa(simd_isa::scalar)
+	{
+	}
+
+	//calculate q*/p without V at cache point (p: position, n: normal) for all candidates and store them in weights
+	void calc_weights(const vec3 &p, const vec3 &n, float *weights) const;
+
+	//return luminance of Le_throughput*FGV of i-th candidate at cache point c memoized in light_path::construct (-1 if not memoized)
+	float memoized_Le_throughput_FGV(const size_t i, const cache &c) const
+	{
+		for(size_t j = 0; j < Nc; j++){
+			if(m_memos[i].p_caches[j] == &c){
+				return m_memos[i].Le_throughput_FGV[j];
+			}
+		}
+		return -1;
+	}
+
+	//return position of i-th candidate
+	vec3 p(const size_t i) const
+	{
+		return vec3(m_px[i], m_py[i], m_pz[i]);
+	}
+
+	size_t size() const
+	{
+		return m_w.size();
+	}
+
+	simd_isa isa() const
+	{
+		return m_isa;
+	}
+
+private:
+
+	//kernels calculate q*/p of candidates [first,size()) in chunks and return index of the first candidate not calculated
+	size_t calc_weights_scalar(const vec3 &p, const vec3 &n, float *weights, const size_t first) const;
+	SIMD_TARGET("sse2") size_t calc_weights_sse(const vec3 &p, const vec3 &n, float *weights) const;
+	SIMD_TARGET("avx2") size_t calc_weights_avx2(const vec3 &p, const vec3 &n, float *weights) const;
+	SIMD_TARGET("avx512f") size_t calc_weights_avx512(const vec3 &p, const vec3 &n, float *weights) const;
+
+	//q*/p memoized at neighbor cache points of the next vertex
+	struct memo{
+		const cache *p_caches[Nc];
+		float Le_throughput_FGV[Nc];
+	};
+
+	std::vector<float> m_px, m_py, m_pz;
+	std::vector<float> m_nx, m_ny, m_nz;
+	std::vector<float> m_w; //luminance of Le_throughput*F
+	std::vector<memo> m_memos;
+	simd_isa m_isa;
+};
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 //cache
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
-class cache : public distribution<candidate>, protected camera_path_vertex
+//resampling pmf of each cache point is stored over indices of candidates shared by all cache points
+class cache : public cache_distribution, protected camera_path_vertex
 {
 public:
 
-	//v: eye sub-path vertex, first_iteration: flag to detect whether first iteration or not
-	cache(const camera_path_vertex &v, const bool first_iteration);
+	//z: eye sub-path, i: index of vertex of z, first_iteration: flag to detect whether first iteration or not
+	cache(const camera_path &z, const size_t i, const bool first_iteration);
 
 	//construct resampling pmf (candidates: pre-sampled light sub-paths)
-	void calc_distribution(const scene &scene, const std::vector<candidate> &candidates, const size_t M);
+	//return number of q*/p reused from light_path::construct
+	size_t calc_distribution(const scene &scene, const candidate_array &candidates, const size_t M);
 
-	//calculate F(brdf)*G(geo term)*V(visibility) at cache point
+	//calculate F(brdf)*G(geo term)*V(visibility) at cache point (V=1 if deferred_visibility)
 	col3 calc_FGV(const scene &scene, const ::intersection &x, const ::brdf &brdf) const;
 
+	//calculate F(brdf)*G(geo term) at cache point and shadow ray for V
+	std::tuple<col3, ray> calc_FG(const ::intersection &x, const ::brdf &brdf) const;
+
 	//return estimate of Q (normalization factor of target distribution)
 	float Q() const
 	{
@@ -186,6 +345,7 @@ public:
 	}
 
 	using camera_path_vertex::intersection;
+	using camera_path_vertex::p;
 
 private:
 
@@ -205,6 +365,7 @@ inline float rr_probability(const col3 &f, const float cos, const float pdf)
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
 #include"path/cache-impl.hpp"
+#include"path/candidate_array-impl.hpp"
 #include"path/light_path-impl.hpp"
 #include"path/camera_path-impl.hpp"
 
@@ -7,8 +7,8 @@ namespace our{
 //cache
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
-//constructor (v: eye sub-path vertex, first_iteration: flag (true for 1st iteration, false otherwise)
-inline cache::cache(const camera_path_vertex &v, const bool first_iteration) : camera_path_vertex(v)
+//constructor (z: eye sub-path, i: index of vertex of z, first_iteration: flag (true for 1st iteration, false otherwise)
+inline cache::cache(const camera_path &z, const size_t i, const bool first_iteration) : camera_path_vertex(z(i))
 {
 	if(first_iteration){
 		m_Q = -1;//for first iteration, normalization factor Q will be estimated in calc_distribution
@@ -16,8 +16,8 @@ inline cache::cache(const camera_path_vertex &v, const bool first_iteration) : c
 	else{
 		//estimate of Q is approximated using Q estimated in previous iteration
 		m_Q = 0;
-		for(size_t i = 0; i < Nc; i++){
-			m_Q += v.neighbor_cache(i).m_Z; //m_Z is estimate of Q using ¥bar{Y}_{n-1} stored at neighbor cache points
+		for(size_t j = 0; j < Nc; j++){
+			m_Q += z.neighbor_cache(i, j).m_Z; //m_Z is estimate of Q using ¥bar{Y}_{n-1} stored at neighbor cache points
 		}
 		m_Q /= Nc;
 	}
@@ -26,14 +26,50 @@ inline cache::cache(const camera_path_vertex &v, const bool first_iteration) : c
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
 //construct resampling pmf
-inline void cache::calc_distribution(const scene &scene, const std::vector<candidate> &candidates, const size_t M)
+inline size_t cache::calc_distribution(const scene &scene, const candidate_array &candidates, const size_t M)
 {
+	thread_local std::vector<float> weights;
+	thread_local std::vector<ray> rays;
+	thread_local std::vector<size_t> ray_candidates;
+	thread_local std::vector<uint64_t> occluded;
+
+	//calculate q*/p without visibility for all candidates at once
+	const auto c_isect = camera_path_vertex::intersection();
+	weights.resize(candidates.size());
+	candidates.calc_weights(c_isect.p(), c_isect.n(), weights.data());
+
+	//collect shadow rays of candidates with q*/p > 0
+	//q*/p (including V) memoized in light_path::construct are reused without shadow rays
+	size_t num_memo_hits = 0;
+	rays.clear();
+	ray_candidates.clear();
+	for(size_t i = 0, n = candidates.size(); i < n; i++){
+
+		if((deferred_visibility == false) && (weights[i] > 0)){
+
+			const float memo = candidates.memoized_Le_throughput_FGV(i, *this);
+			if(memo >= 0){
+				weights[i] = memo; num_memo_hits++;
+				continue;
+			}
+
+			const vec3 tmp_wi = candidates.p(i) - c_isect.p();
+			const float dist = sqrt(squared_norm(tmp_wi));
+			rays.push_back(ray(c_isect.p(), tmp_wi / dist, dist)); ray_candidates.push_back(i);
+		}
+	}
+
+	//visibility tests for V are resolved for all candidates at once
+	scene.intersect(rays, occluded);
+	for(size_t i = 0, n = rays.size(); i < n; i++){
+		if((occluded[i / 64] >> (i % 64)) & 1){
+			weights[ray_candidates[i]] = 0;
+		}
+	}
+
 	//construct resampling pmf (q*/p) (Line 5 in Algorithm1)
-	auto weight = [&](const candidate &c){ 
-		return luminance(c.vertex().Le_throughput() * calc_FGV(scene, c.vertex().intersection(), c.vertex().brdf())); 
-	};
-	distribution<candidate>::operator=(
-		distribution<candidate>(candidates, weight)
+	cache_distribution::operator=(
+		cache_distribution(weights)
 	);
 
 	//estimate Q using M pre-sampled light sub-paths in current iteration
@@ -44,6 +80,7 @@ inline void cache::calc_distribution(const scene &scene, const std::vector<candi
 	if(m_Q == -1){
 		m_Q = m_Z;
 	}
+	return num_memo_hits;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -51,28 +88,39 @@ inline void cache::calc_distribution(const scene &scene, const std::vector<candi
 //calculate F(brdf)*G(geo. term)*V(visibility) at cache point
 inline col3 cache::calc_FGV(const scene &scene, const ::intersection &x, const ::brdf &brdf) const
 {
-	const auto &c_isect = camera_path_vertex::intersection();
+	const auto FG_ray = calc_FG(x, brdf);
+	const col3 &FG = std::get<0>(FG_ray);
+
+	//visibility test for V
+	if((std::max(FG[0], std::max(FG[1], FG[2])) > 0) && (deferred_visibility || (scene.intersect(std::get<1>(FG_ray)) == false))){
+		return FG;
+	}
+	return col3();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+//calculate F(brdf)*G(geo. term) at cache point, and shadow ray from cache point to x for V
+inline std::tuple<col3, ray> cache::calc_FG(const ::intersection &x, const ::brdf &brdf) const
+{
+	const auto c_isect = camera_path_vertex::intersection();
 
 	const vec3 tmp_wo = c_isect.p() - x.p();
 	const float dist2 = squared_norm(tmp_wo);
 	const float dist = sqrt(dist2);
 	const direction wo(tmp_wo / dist, x.n());
 	if(wo.is_invalid() || wo.in_lower_hemisphere()){
-		return col3();
+		return std::make_tuple(col3(), ray(c_isect.p(), vec3(), 0));
 	}
 
 	const direction wi(-wo, c_isect.n());
 	if(wi.is_invalid() || wi.in_lower_hemisphere()){
-		return col3();
-	}
-	
-	//visibility test for V
-	if(scene.intersect(ray(c_isect.p(), wi, dist)) == false){
-		//clamp G term to avoid unstable estimation of Q
-		//(for glossy BRDFs, it would be better to clamp F*G instead of G only)
-		return brdf.f(wo) * std::min(wi.abs_cos() * wo.abs_cos() / dist2, G_max);
+		return std::make_tuple(col3(), ray(c_isect.p(), vec3(), 0));
 	}
-	return col3();
+
+	//clamp G term to avoid unstable estimation of Q
+	//(for glossy BRDFs, it would be better to clamp F*G instead of G only)
+	return std::make_tuple(brdf.f(wo) * std::min(wi.abs_cos() * wo.abs_cos() / dist2, G_max), ray(c_isect.p(), wi, dist));
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
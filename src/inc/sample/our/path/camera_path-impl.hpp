@@ -11,14 +11,13 @@ namespace our{
 inline void camera_path::construct(const scene &scene, const camera &camera, const int x, const int y, random_number_generator &rng)
 {
 	m_vertices.clear();
+	mp_caches = nullptr;
 
-	//number of samples for strategies (s>=1,t=1) (used in MIS weights)
-	m_ns1 = camera.res_x() * camera.res_y();
-
+	rng.set_dimension(0);
 	ray r = camera.sample(x, y, rng);
 
 	//generate path vertex on lens, store camera to material
-	m_vertices.emplace_back(intersection(r.o(), camera.d(), reinterpret_cast<const material*>(&camera)), brdf(), direction(), direction(), col3(1), camera.pdf_o());
+	m_vertices.emplace_back(intersection(r.o(), camera.d(), reinterpret_cast<const material*>(&camera)), col3(1), camera.pdf_o());
 
 	float pdf = camera.pdf_d(direction(r.d(), camera.d()));
 
@@ -42,19 +41,19 @@ inline void camera_path::construct(const scene &scene, const camera &camera, con
 
 		//if isect is on light source, add isect and terminate tracing
 		if(isect.material().is_emissive()){
-			m_vertices.emplace_back(isect, brdf(), wo, direction(isect.n()), throughput_We, pdf);
+			m_vertices.emplace_back(isect, throughput_We, pdf);
 			break;
 		}
 
+		//sample direction (vertices except lens are generated by bounces)
 		const brdf brdf = isect.material().make_brdf(isect, wo);
+		rng.set_dimension(bounce_dimension(num_vertices() - 1));
 		const brdf_sample sample = brdf.sample(rng);
 
 		//add path vertex
+		m_vertices.emplace_back(isect, throughput_We, pdf);
 		if(sample.is_invalid()){
-			m_vertices.emplace_back(isect, brdf, wo, direction(), throughput_We, pdf);
 			break;
-		}else{
-			m_vertices.emplace_back(isect, brdf, wo, sample.w(), throughput_We, pdf);
 		}
 
 		//russian roulette
@@ -77,22 +76,22 @@ inline void camera_path::construct(const scene &scene, const camera &camera, con
 }
 
 //construct eye sub-path
-inline void camera_path::construct(const scene &scene, const camera &camera, const int x, const int y, random_number_generator &rng, const kd_tree<cache> &caches)
+inline void camera_path::construct(const scene &scene, const camera &camera, const int x, const int y, random_number_generator &rng, const cache_index &caches)
 {
 	//construct path
 	construct(scene, camera, x, y, rng);
+	mp_caches = &caches;
 
 	//precompute variables used in MIS weights
 	{
 		//search nearest cache points
-		thread_local std::vector<neighbor<cache>> neighbors;
 		for(size_t i = 1, n = num_vertices(); i < n; i++){
 
 			auto &zi = operator()(i);
-			caches.find_nearest(zi.intersection().p(), FLT_MAX, Nc, neighbors);
+			const auto neighbors = caches.find_nearest<Nc>(zi.p());
 
 			for(size_t j = 0; j < Nc; j++){
-				zi.set_neighbor_cache(j, *neighbors[j]);
+				zi.set_neighbor_cache(j, neighbors[j].index());
 			}
 		}
 
@@ -100,8 +99,7 @@ inline void camera_path::construct(const scene &scene, const camera &camera, con
 		for(size_t i = 1, n = num_vertices(); i + 2 < n; i++){
 		
 			auto &zi = operator()(i);
-			auto &zip1 = operator()(i + 1);
-			auto pdfs_FG = light_path::pdfs_FG(scene, zi, zip1, zi.FGVc());
+			auto pdfs_FG = light_path::pdfs_FG(scene, *this, i, zi.FGVc());
 			zi.set_pdf_bwd(std::get<0>(pdfs_FG));
 			zi.set_pdf_bwd_rr(std::get<1>(pdfs_FG));
 			zi.set_FG_bwd(std::get<2>(pdfs_FG));
@@ -112,7 +110,7 @@ inline void camera_path::construct(const scene &scene, const camera &camera, con
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
 //calculate MIS partial weight
-inline float camera_path::mis_partial_weight(const scene &scene, const light_path &y, const size_t s, const camera_path &z, const size_t t, const direction &yz, const direction &zy, const float M, const float Qp)
+inline float camera_path::mis_partial_weight(const scene &scene, const light_path &y, const size_t s, const camera_path &z, const size_t t, const direction &yz, const direction &zy, const float M, const float Qp, const float ns1)
 {
 	float w = 0;
 	{
@@ -125,7 +123,7 @@ inline float camera_path::mis_partial_weight(const scene &scene, const light_pat
 				col3 FG_zim1;
 				float pdf_L_zim1;
 				if(i == t - 1){
-					const auto pdf_FG = light_path::pdf_FG(scene, z(t - 2), z(t - 1), s + (t - (i - 1)), zy, FGVc);
+					const auto pdf_FG = light_path::pdf_FG(scene, z, t, s + (t - (i - 1)), zy, FGVc);
 					pdf_L_zim1 = std::get<0>(pdf_FG);
 					FG_zim1 = std::get<1>(pdf_FG);
 
@@ -138,11 +136,11 @@ inline float camera_path::mis_partial_weight(const scene &scene, const light_pat
 			}
 			
 			if(i == 1){
-				w += z.m_ns1;
+				w += ns1;
 			}else{
 				for(size_t j = 0; j < Nc; j++){
 			
-					const float Q = z(i - 1).neighbor_cache(j).Q();
+					const float Q = z.neighbor_cache(i - 1, j).Q();
 					const float Le_throughput_FGVc = luminance(Le_throughput * FGVc[j]);
 			
 					if(Le_throughput_FGVc > 0){
@@ -171,18 +169,23 @@ inline float camera_path::mis_partial_weight(const scene &scene, const light_pat
 //sampling pdfs (without/with RR) of y(i) from y(i+1)
 inline std::tuple<float, float> camera_path::pdfs(const light_path_vertex &yi, const light_path_vertex &yip1)
 {
-	auto &yi_isect = yi.intersection();
-	auto &yip1_isect = yip1.intersection();
+	const auto yi_isect = yi.intersection();
+	const auto yip1_isect = yip1.intersection();
+
+	//directions between y(i) and y(i+1) (yi_wo: outgoing direction at y(i), yip1_wi: incident direction at y(i+1))
+	const auto dirs = calc_directions(yi_isect, yip1_isect);
+	const direction &yi_wo = std::get<0>(dirs);
+	const direction &yip1_wi = std::get<1>(dirs);
 
 	//BRDF at y(i+1)
-	const auto brdf = yip1_isect.material().make_brdf(yip1_isect, yip1.wo());
+	const auto brdf = yip1_isect.material().make_brdf(yip1_isect, yip1_wi);
 
 	//pdf of solid angle measure
-	const float pdf_w = brdf.pdf(yip1.wi());
-	const float pdf_w_rr = pdf_w * rr_probability(brdf.f(yip1.wi()), yip1.wi().abs_cos(), pdf_w);
+	const float pdf_w = brdf.pdf(yip1_wi);
+	const float pdf_w_rr = pdf_w * rr_probability(brdf.f(yip1_wi), yip1_wi.abs_cos(), pdf_w);
 
 	//convert to area measure
-	const float J = yi.wo().abs_cos() / squared_norm(yi_isect.p() - yip1_isect.p());
+	const float J = yi_wo.abs_cos() / std::get<2>(dirs);
 	const float pdf_A = pdf_w * J;
 	const float pdf_A_rr = pdf_w_rr * J;
 	return std::make_tuple(pdf_A, pdf_A_rr);
@@ -203,18 +206,19 @@ inline float camera_path::pdf(const light_path_vertex &ysm1, const camera_path_v
 {
 	float pdf_w;
 
-	if(n==1){
+	if(n==2){ //z(t-1) on lens (y(s-1) is 2nd vertex from eye)
 		pdf_w = reinterpret_cast<const class camera&>(ztm1.intersection().material()).pdf_d(zy);
 	}
 	else{ //z(t-1) on surfaces
-		pdf_w = ztm1.brdf().pdf(zy);
+		const auto ztm1_brdf = ztm1.brdf();
+		pdf_w = ztm1_brdf.pdf(zy);
 		if(n > rr_threshold){
-			pdf_w *= rr_probability(ztm1.brdf().f(zy), zy.abs_cos(), pdf_w);
+			pdf_w *= rr_probability(ztm1_brdf.f(zy), zy.abs_cos(), pdf_w);
 		}
 	}
 
     //convert to area measure
-	return pdf_w * yz.abs_cos() / squared_norm(ztm1.intersection().p() - ysm1.intersection().p());
+	return pdf_w * yz.abs_cos() / squared_norm(ztm1.p() - ysm1.p());
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -222,18 +226,23 @@ inline float camera_path::pdf(const light_path_vertex &ysm1, const camera_path_v
 //sampling pdf of y(s-2) (ysm2) from y(s-1) (ysm1)
 inline float camera_path::pdf(const light_path_vertex &ysm2, const light_path_vertex &ysm1, const size_t n, const direction &yz)
 {
+	//directions between y(s-2) and y(s-1) (ysm2_wo: outgoing direction at y(s-2), ysm1_wi: incident direction at y(s-1))
+	const auto ysm1_isect = ysm1.intersection();
+	const auto dirs = calc_directions(ysm2.intersection(), ysm1_isect);
+	const direction &ysm2_wo = std::get<0>(dirs);
+	const direction &ysm1_wi = std::get<1>(dirs);
+
 	//BRDF at y(s-1)
-	const auto &ysm1_isect = ysm1.intersection();
 	const auto brdf = ysm1_isect.material().make_brdf(ysm1_isect, yz);
 
 	//solid angle pdf
-	float pdf_w = brdf.pdf(ysm1.wi());
+	float pdf_w = brdf.pdf(ysm1_wi);
 	if(n > rr_threshold){
-		pdf_w *= rr_probability(brdf.f(ysm1.wi()), ysm1.wi().abs_cos(), pdf_w);
+		pdf_w *= rr_probability(brdf.f(ysm1_wi), ysm1_wi.abs_cos(), pdf_w);
 	}
 
 	//convert to area measure
-	return pdf_w * ysm2.wo().abs_cos() / squared_norm(ysm2.intersection().p() - ysm1_isect.p());
+	return pdf_w * ysm2_wo.abs_cos() / std::get<2>(dirs);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
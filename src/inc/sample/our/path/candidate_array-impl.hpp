@@ -0,0 +1,172 @@
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace our{
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//candidate_array
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+//constructor (candidates: pre-sampled light sub-paths, isa: instruction set of kernels)
+inline candidate_array::candidate_array(const std::vector<candidate> &candidates, const simd_isa isa) : m_isa(isa)
+{
+	const size_t n = candidates.size();
+	m_px.resize(n); m_py.resize(n); m_pz.resize(n);
+	m_nx.resize(n); m_ny.resize(n); m_nz.resize(n);
+	m_w.resize(n);
+	m_memos.resize(n);
+
+	for(size_t i = 0; i < n; i++){
+
+		const auto &v = candidates[i].vertex();
+		const auto x = v.intersection();
+		m_px[i] = x.p().x; m_py[i] = x.p().y; m_pz[i] = x.p().z;
+		m_nx[i] = x.n().x; m_ny[i] = x.n().y; m_nz[i] = x.n().z;
+
+		//diffuse BRDF is constant, so that it is evaluated toward normal
+		m_w[i] = luminance(v.Le_throughput() * v.brdf().f(direction(x.n())));
+
+		//light_path::construct evaluates FGV of y(i) at neighbor cache points of y(i+1)
+		const auto &path = candidates[i].path();
+		const size_t s = candidates[i].s();
+		for(size_t j = 0; j < Nc; j++){
+			if(s < path.num_vertices()){
+				m_memos[i].p_caches[j] = &path.neighbor_cache(s, j);
+				m_memos[i].Le_throughput_FGV[j] = path(s).Le_throughput_FGVc(j);
+			}else{
+				m_memos[i].p_caches[j] = nullptr;
+				m_memos[i].Le_throughput_FGV[j] = -1;
+			}
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+//calculate q*/p without V at cache point (p: position, n: normal) for all candidates
+inline void candidate_array::calc_weights(const vec3 &p, const vec3 &n, float *weights) const
+{
+	size_t first = 0;
+	switch(m_isa){
+#if defined(SIMD_X86)
+		case simd_isa::avx512: first = calc_weights_avx512(p, n, weights); break;
+		case simd_isa::avx2:   first = calc_weights_avx2(p, n, weights); break;
+		case simd_isa::sse:    first = calc_weights_sse(p, n, weights); break;
+#endif
+		default:               break;
+	}
+
+	//remainder of chunks
+	calc_weights_scalar(p, n, weights, first);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+//kernels evaluate the same expressions as cache::calc_FG except that F*G is calculated as (Le_throughput*F)*G
+//directions with cosine smaller than 1e-6 are invalidated as in class direction
+inline size_t candidate_array::calc_weights_scalar(const vec3 &p, const vec3 &n, float *weights, const size_t first) const
+{
+	const size_t num = size();
+	for(size_t i = first; i < num; i++){
+
+		const float dx = p.x - m_px[i];
+		const float dy = p.y - m_py[i];
+		const float dz = p.z - m_pz[i];
+		const float dist2 = dx * dx + dy * dy + dz * dz;
+		const float dist = sqrt(dist2);
+
+		//cosines at candidate (wo) and cache point (wi=-wo)
+		const float cos_x = (dx * m_nx[i] + dy * m_ny[i] + dz * m_nz[i]) / dist;
+		const float cos_c = -(dx * n.x + dy * n.y + dz * n.z) / dist;
+
+		weights[i] = ((cos_x >= 1e-6f) && (cos_c >= 1e-6f)) ? m_w[i] * std::min(cos_x * cos_c / dist2, G_max) : 0;
+	}
+	return num;
+}
+
+#if defined(SIMD_X86)
+
+SIMD_TARGET("sse2") inline size_t candidate_array::calc_weights_sse(const vec3 &p, const vec3 &n, float *weights) const
+{
+	const __m128 px = _mm_set1_ps(p.x), py = _mm_set1_ps(p.y), pz = _mm_set1_ps(p.z);
+	const __m128 nx = _mm_set1_ps(-n.x), ny = _mm_set1_ps(-n.y), nz = _mm_set1_ps(-n.z);
+	const __m128 eps = _mm_set1_ps(1e-6f);
+	const __m128 G_max_ = _mm_set1_ps(G_max);
+
+	size_t i = 0;
+	for(const size_t num = size(); i + 4 <= num; i += 4){
+
+		const __m128 dx = _mm_sub_ps(px, _mm_loadu_ps(&m_px[i]));
+		const __m128 dy = _mm_sub_ps(py, _mm_loadu_ps(&m_py[i]));
+		const __m128 dz = _mm_sub_ps(pz, _mm_loadu_ps(&m_pz[i]));
+		const __m128 dist2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+		const __m128 dist = _mm_sqrt_ps(dist2);
+
+		const __m128 cos_x = _mm_div_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, _mm_loadu_ps(&m_nx[i])), _mm_mul_ps(dy, _mm_loadu_ps(&m_ny[i]))), _mm_mul_ps(dz, _mm_loadu_ps(&m_nz[i]))), dist);
+		const __m128 cos_c = _mm_div_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, nx), _mm_mul_ps(dy, ny)), _mm_mul_ps(dz, nz)), dist);
+
+		const __m128 G = _mm_min_ps(_mm_div_ps(_mm_mul_ps(cos_x, cos_c), dist2), G_max_);
+		const __m128 valid = _mm_and_ps(_mm_cmpge_ps(cos_x, eps), _mm_cmpge_ps(cos_c, eps));
+		_mm_storeu_ps(&weights[i], _mm_and_ps(valid, _mm_mul_ps(_mm_loadu_ps(&m_w[i]), G)));
+	}
+	return i;
+}
+
+SIMD_TARGET("avx2") inline size_t candidate_array::calc_weights_avx2(const vec3 &p, const vec3 &n, float *weights) const
+{
+	const __m256 px = _mm256_set1_ps(p.x), py = _mm256_set1_ps(p.y), pz = _mm256_set1_ps(p.z);
+	const __m256 nx = _mm256_set1_ps(-n.x), ny = _mm256_set1_ps(-n.y), nz = _mm256_set1_ps(-n.z);
+	const __m256 eps = _mm256_set1_ps(1e-6f);
+	const __m256 G_max_ = _mm256_set1_ps(G_max);
+
+	size_t i = 0;
+	for(const size_t num = size(); i + 8 <= num; i += 8){
+
+		const __m256 dx = _mm256_sub_ps(px, _mm256_loadu_ps(&m_px[i]));
+		const __m256 dy = _mm256_sub_ps(py, _mm256_loadu_ps(&m_py[i]));
+		const __m256 dz = _mm256_sub_ps(pz, _mm256_loadu_ps(&m_pz[i]));
+		const __m256 dist2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_mul_ps(dz, dz));
+		const __m256 dist = _mm256_sqrt_ps(dist2);
+
+		const __m256 cos_x = _mm256_div_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, _mm256_loadu_ps(&m_nx[i])), _mm256_mul_ps(dy, _mm256_loadu_ps(&m_ny[i]))), _mm256_mul_ps(dz, _mm256_loadu_ps(&m_nz[i]))), dist);
+		const __m256 cos_c = _mm256_div_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, nx), _mm256_mul_ps(dy, ny)), _mm256_mul_ps(dz, nz)), dist);
+
+		const __m256 G = _mm256_min_ps(_mm256_div_ps(_mm256_mul_ps(cos_x, cos_c), dist2), G_max_);
+		const __m256 valid = _mm256_and_ps(_mm256_cmp_ps(cos_x, eps, _CMP_GE_OQ), _mm256_cmp_ps(cos_c, eps, _CMP_GE_OQ));
+		_mm256_storeu_ps(&weights[i], _mm256_and_ps(valid, _mm256_mul_ps(_mm256_loadu_ps(&m_w[i]), G)));
+	}
+	return i;
+}
+
+SIMD_TARGET("avx512f") inline size_t candidate_array::calc_weights_avx512(const vec3 &p, const vec3 &n, float *weights) const
+{
+	const __m512 px = _mm512_set1_ps(p.x), py = _mm512_set1_ps(p.y), pz = _mm512_set1_ps(p.z);
+	const __m512 nx = _mm512_set1_ps(-n.x), ny = _mm512_set1_ps(-n.y), nz = _mm512_set1_ps(-n.z);
+	const __m512 eps = _mm512_set1_ps(1e-6f);
+	const __m512 G_max_ = _mm512_set1_ps(G_max);
+
+	size_t i = 0;
+	for(const size_t num = size(); i + 16 <= num; i += 16){
+
+		const __m512 dx = _mm512_sub_ps(px, _mm512_loadu_ps(&m_px[i]));
+		const __m512 dy = _mm512_sub_ps(py, _mm512_loadu_ps(&m_py[i]));
+		const __m512 dz = _mm512_sub_ps(pz, _mm512_loadu_ps(&m_pz[i]));
+		const __m512 dist2 = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(dx, dx), _mm512_mul_ps(dy, dy)), _mm512_mul_ps(dz, dz));
+		const __m512 dist = _mm512_sqrt_ps(dist2);
+
+		const __m512 cos_x = _mm512_div_ps(_mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(dx, _mm512_loadu_ps(&m_nx[i])), _mm512_mul_ps(dy, _mm512_loadu_ps(&m_ny[i]))), _mm512_mul_ps(dz, _mm512_loadu_ps(&m_nz[i]))), dist);
+		const __m512 cos_c = _mm512_div_ps(_mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(dx, nx), _mm512_mul_ps(dy, ny)), _mm512_mul_ps(dz, nz)), dist);
+
+		const __m512 G = _mm512_min_ps(_mm512_div_ps(_mm512_mul_ps(cos_x, cos_c), dist2), G_max_);
+		const __mmask16 valid = _mm512_cmp_ps_mask(cos_x, eps, _CMP_GE_OQ) & _mm512_cmp_ps_mask(cos_c, eps, _CMP_GE_OQ);
+		_mm512_storeu_ps(&weights[i], _mm512_maskz_mul_ps(valid, _mm512_loadu_ps(&m_w[i]), G));
+	}
+	return i;
+}
+
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+} //namespace our
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -8,14 +8,18 @@ namespace our{
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
 //construct light sub-path
-inline void light_path::construct(const scene &scene, random_number_generator &rng, const kd_tree<cache> &caches)
+inline void light_path::construct(const scene &scene, random_number_generator &rng, const cache_index &caches, light_path_arena &arena, const bool find_neighbor_caches)
 {
-	m_vertices.clear();
+	mp_arena = &arena;
+	m_offset = arena.size();
+	m_size = 0;
+	mp_caches = &caches;
 
-	//initialize m_vertices using "dummy" path vertex to avoid out of range access when MIS is calculated, ptr to scene is stored in material
-	m_vertices.emplace_back(intersection(vec3(), vec3(), reinterpret_cast<const material*>(&scene)), brdf(), direction(), direction(), col3(), 0.0f);
+	//initialize vertices using "dummy" path vertex to avoid out of range access when MIS is calculated, ptr to scene is stored in material
+	add_vertex(intersection(vec3(), vec3(), reinterpret_cast<const material*>(&scene)), col3(), 0.0f);
 
 	//sample point on light source
+	rng.set_dimension(0);
 	const sample_point lsample = scene.sample_light(rng);
 	if(lsample.is_invalid()){
 		return;
@@ -23,15 +27,14 @@ inline void light_path::construct(const scene &scene, random_number_generator &r
 
 	//sample outgoing direction
 	const brdf lbrdf = lsample.material().make_brdf(lsample, direction(lsample.n()));
+	rng.set_dimension(emission_dimension);
 	const brdf_sample bsample = lbrdf.sample(rng);
 
 	//add path vertex
 	col3 Le_throughput = lsample.material().Me() / lsample.pdf();
+	add_vertex(lsample, Le_throughput, lsample.pdf());
 	if(bsample.is_invalid()){
-		m_vertices.emplace_back(lsample, lbrdf, direction(lsample.n()), direction(), Le_throughput, lsample.pdf());
 		return;
-	}else{
-		m_vertices.emplace_back(lsample, lbrdf, direction(lsample.n()), bsample.w(), Le_throughput, lsample.pdf());
 	}
 
 	//generate path
@@ -58,16 +61,15 @@ inline void light_path::construct(const scene &scene, random_number_generator &r
 			break;
 		}
 	
-		//sample direction
+		//sample direction (vertices except light source are generated by bounces, i.e., k-th bounce at y(k+1))
 		const brdf brdf = isect.material().make_brdf(isect, wi);
+		rng.set_dimension(bounce_dimension(num_vertices() - 1));
 		const brdf_sample sample = brdf.sample(rng);
 
 		//add path vertex
+		add_vertex(isect, Le_throughput, pdf);
 		if(sample.is_invalid()){
-			m_vertices.emplace_back(isect, brdf, wi, direction(), Le_throughput, pdf);
 			break;
-		}else{
-			m_vertices.emplace_back(isect, brdf, wi, sample.w(), Le_throughput, pdf);
 		}
 
 		//russian roulette
@@ -88,17 +90,28 @@ inline void light_path::construct(const scene &scene, random_number_generator &r
 		Le_throughput *= sample.f() * sample.w().abs_cos() / pdf;
 	}
 
-	//precompute variables for MIS weights
-	{
-		//search neighbor cache points
-		thread_local std::vector<neighbor<cache>> neighbors;
+	//search neighbor cache points
+	if(find_neighbor_caches){
+		thread_local std::vector<std::array<neighbor<cache>, Nc>> neighbors;
+		neighbors.clear();
 		for(size_t i = 1, n = num_vertices(); i < n; i++){
+			neighbors.push_back(caches.find_nearest<Nc>(operator()(i).p()));
+		}
+		set_neighbor_caches(scene, neighbors.data());
+	}
+}
 
-			auto &yi = operator()(i);
-			caches.find_nearest(yi.intersection().p(), FLT_MAX, Nc, neighbors);
+///////////////////////////////////////////////////////////////////////////////////////////////////
 
+//set neighbor cache points of y(1),y(2),... and precompute variables for MIS weights
+inline void light_path::set_neighbor_caches(const scene &scene, const std::array<neighbor<cache>, Nc> *neighbors)
+{
+	//precompute variables for MIS weights
+	{
+		//neighbor cache points
+		for(size_t i = 1, n = num_vertices(); i < n; i++){
 			for(size_t j = 0; j < Nc; j++){
-				yi.set_neighbor_cache(j, *neighbors[j]);
+				operator()(i).set_neighbor_cache(j, neighbors[i - 1][j].index());
 			}
 		}
 
@@ -112,13 +125,42 @@ inline void light_path::construct(const scene &scene, random_number_generator &r
 		}
 
 		//set q*/p
+		//visibility tests at neighbor cache points are resolved for all vertices at once
+		//q*/p of y(i-1) stored at y(i) are also memo for cache::calc_distribution (see candidate::memoized_Le_throughput_FGV)
+		thread_local std::vector<col3> Le_throughput_FGVc;
+		thread_local std::vector<ray> rays;
+		thread_local std::vector<size_t> ray_indices;
+		thread_local std::vector<uint64_t> occluded;
+
+		Le_throughput_FGVc.clear();
+		rays.clear();
+		ray_indices.clear();
 		for(size_t i = 1, n = num_vertices(); i < n; i++){
 		
-			auto &yi = operator()(i);
-			auto &yim1 = operator()(i - 1);
+			const auto &yim1 = operator()(i - 1);
+			const auto yim1_isect = yim1.intersection();
+			const auto yim1_brdf = yim1.brdf();
 
 			for(size_t j = 0; j < Nc; j++){
-				yi.set_Le_throughput_FGVc(j, yim1.Le_throughput() * yi.neighbor_cache(j).calc_FGV(scene, yim1.intersection(), yim1.brdf()));
+				const auto FG_ray = neighbor_cache(i, j).calc_FG(yim1_isect, yim1_brdf);
+				const col3 &FG = std::get<0>(FG_ray);
+				if((deferred_visibility == false) && (std::max(FG[0], std::max(FG[1], FG[2])) > 0)){
+					rays.push_back(std::get<1>(FG_ray)); ray_indices.push_back(Le_throughput_FGVc.size());
+				}
+				Le_throughput_FGVc.push_back(yim1.Le_throughput() * FG);
+			}
+		}
+
+		scene.intersect(rays, occluded);
+		for(size_t i = 0, n = rays.size(); i < n; i++){
+			if((occluded[i / 64] >> (i % 64)) & 1){
+				Le_throughput_FGVc[ray_indices[i]] = col3();
+			}
+		}
+
+		for(size_t i = 1, n = num_vertices(); i < n; i++){
+			for(size_t j = 0; j < Nc; j++){
+				operator()(i).set_Le_throughput_FGVc(j, Le_throughput_FGVc[(i - 1) * Nc + j]);
 			}
 		}
 	}
@@ -137,7 +179,7 @@ inline float light_path::mis_partial_weight(const light_path &y, const size_t s,
 		}else{
 			for(size_t j = 0; j < Nc; j++){
 
-				const float Q = y(i).neighbor_cache(j).Q();
+				const float Q = y.neighbor_cache(i, j).Q();
 				const float Le_throughput_FGVc = y(i).Le_throughput_FGVc(j);
 					
 				if(Le_throughput_FGVc > 0){ 
@@ -161,30 +203,35 @@ inline float light_path::mis_partial_weight(const light_path &y, const size_t s,
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
 //return pdfs (without/with RR) and FG, and calculate FGV at neighbor cache points of z(i)
-//zi: z(i), zip1: z(i+1), FGVc: array to store FGVs
-inline std::tuple<float, float, col3> light_path::pdfs_FG(const scene &scene, const camera_path_vertex &zi, const camera_path_vertex &zip1, std::array<col3, Nc> &FGVc)
+//z: eye sub-path, i: index of z(i), FGVc: array to store FGVs
+inline std::tuple<float, float, col3> light_path::pdfs_FG(const scene &scene, const camera_path &z, const size_t i, std::array<col3, Nc> &FGVc)
 {
-	auto &zi_isect = zi.intersection();
-	auto &zip1_isect = zip1.intersection();
+	const auto zi_isect = z(i).intersection();
+	const auto zip1_isect = z(i + 1).intersection();
+
+	//directions between z(i) and z(i+1) (zi_wi: incident direction at z(i), zip1_wo: outgoing direction at z(i+1))
+	const auto dirs = calc_directions(zi_isect, zip1_isect);
+	const direction &zi_wi = std::get<0>(dirs);
+	const direction &zip1_wo = std::get<1>(dirs);
 
 	//BRDF at z(i+1)
-	const auto brdf = zip1_isect.material().make_brdf(zip1_isect, zip1.wi());
+	const auto brdf = zip1_isect.material().make_brdf(zip1_isect, zip1_wo);
 
 	//solid angle pdf
-	const float pdf_w = brdf.pdf(zip1.wo());
-	const float pdf_w_rr = pdf_w * rr_probability(brdf.f(zip1.wo()), zip1.wo().abs_cos(), pdf_w);
+	const float pdf_w = brdf.pdf(zip1_wo);
+	const float pdf_w_rr = pdf_w * rr_probability(brdf.f(zip1_wo), zip1_wo.abs_cos(), pdf_w);
 
 	//convert to area measure
-	const float J = zi.wi().abs_cos() / squared_norm(zi_isect.p() - zip1_isect.p());
+	const float J = zi_wi.abs_cos() / std::get<2>(dirs);
 	const float pdf_A = pdf_w * J;
 	const float pdf_A_rr = pdf_w_rr * J;
 
 	//calculate FG
-	const col3 FG = brdf.f(zip1.wo()) * (zip1.wo().abs_cos() * J);
+	const col3 FG = brdf.f(zip1_wo) * (zip1_wo.abs_cos() * J);
 
 	//calculate FGV at neighbor cache points of z(i)
-	for(size_t i = 0; i < Nc; i++){
-		FGVc[i] = zi.neighbor_cache(i).calc_FGV(scene, zip1_isect, brdf);
+	for(size_t j = 0; j < Nc; j++){
+		FGVc[j] = z.neighbor_cache(i, j).calc_FGV(scene, zip1_isect, brdf);
 	}
 	return std::make_tuple(pdf_A, pdf_A_rr, FG);
 }
@@ -200,29 +247,36 @@ inline float light_path::pdf(const camera_path_vertex &zi, const camera_path_ver
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
 //return pdf and FG and calculate FGV at cache points neighbor to z(t-2)
-//ztm2: z(t-2), ztm1: z(t-1), n: z(i) is n-th vertex from light source, zy: direction from z(t-1) to y(s-1), FGVc: array to store FGV
-inline std::tuple<float, col3> light_path::pdf_FG(const scene &scene, const camera_path_vertex &ztm2, const camera_path_vertex &ztm1, const size_t n, const direction &zy, std::array<col3, Nc> &FGVc)
+//z: eye sub-path, t: z(t-1) is the last vertex used, n: z(t-2) is n-th vertex from light source, zy: direction from z(t-1) to y(s-1), FGVc: array to store FGV
+inline std::tuple<float, col3> light_path::pdf_FG(const scene &scene, const camera_path &z, const size_t t, const size_t n, const direction &zy, std::array<col3, Nc> &FGVc)
 {
+	const auto ztm2_isect = z(t - 2).intersection();
+	const auto ztm1_isect = z(t - 1).intersection();
+
+	//directions between z(t-2) and z(t-1) (ztm2_wi: incident direction at z(t-2), ztm1_wo: outgoing direction at z(t-1))
+	const auto dirs = calc_directions(ztm2_isect, ztm1_isect);
+	const direction &ztm2_wi = std::get<0>(dirs);
+	const direction &ztm1_wo = std::get<1>(dirs);
+
 	//BRDF at z(t-1)
-	const auto &ztm1_isect = ztm1.intersection();
 	const auto brdf = ztm1_isect.material().make_brdf(ztm1_isect, zy);
 
 	//solid angle pdf
-	float pdf_w = brdf.pdf(ztm1.wo());
+	float pdf_w = brdf.pdf(ztm1_wo);
 	if(n > rr_threshold){
-		pdf_w *= rr_probability(brdf.f(ztm1.wo()), ztm1.wo().abs_cos(), pdf_w);
+		pdf_w *= rr_probability(brdf.f(ztm1_wo), ztm1_wo.abs_cos(), pdf_w);
 	}
 
 	//convert to area measure
-	const float J = ztm2.wi().abs_cos() / squared_norm(ztm2.intersection().p() - ztm1_isect.p());
+	const float J = ztm2_wi.abs_cos() / std::get<2>(dirs);
 	const float pdf_A = pdf_w * J;
 
 	//calculate FG
-	const col3 FG = brdf.f(ztm1.wo()) * (ztm1.wo().abs_cos() * J);
+	const col3 FG = brdf.f(ztm1_wo) * (ztm1_wo.abs_cos() * J);
 
 	//calculate FGV at cache points neighbor to z(t-2)
-	for(size_t i = 0; i < Nc; i++){
-		FGVc[i] = ztm2.neighbor_cache(i).calc_FGV(scene, ztm1_isect, brdf);
+	for(size_t j = 0; j < Nc; j++){
+		FGVc[j] = z.neighbor_cache(t - 2, j).calc_FGV(scene, ztm1_isect, brdf);
 	}
 	return std::make_tuple(pdf_A, FG);
 }
@@ -233,31 +287,29 @@ inline std::tuple<float, col3> light_path::pdf_FG(const scene &scene, const came
 //ztm1: z(t-1), ysm1: y(s-1), n: z(i) is n-th vertex from light source, zy: direction from z(t-1) to y(s-1), yz: direction from y(s-1) to z(t-1)
 inline std::tuple<float, col3> light_path::pdf_FG(const camera_path_vertex &ztm1, const light_path_vertex &ysm1, const size_t n, const direction &zy, const direction &yz)
 {
-	const auto &ztm1_isect = ztm1.intersection();
-	const auto &ysm1_isect = ysm1.intersection();
-
 	col3 FG;
 	float pdf_A;
 
-	if(ztm1_isect.material().is_emissive()){ //z(t-1) is on light source
+	if(ztm1.material().is_emissive()){ //z(t-1) is on light source
 		//intersection::material in y(-1) stores ptr to scene
-		pdf_A = reinterpret_cast<const scene&>(ysm1_isect.material()).pdf_light(ztm1_isect);
-		FG = ztm1_isect.material().Me();
+		pdf_A = reinterpret_cast<const scene&>(ysm1.material()).pdf_light(ztm1.intersection());
+		FG = ztm1.material().Me();
 	}
 	//z(t-1) is on (non-emissive) surface
 	else{
 		//calculate solid angle pdf
-		float pdf_w = ysm1.brdf().pdf(yz);
+		const auto ysm1_brdf = ysm1.brdf();
+		float pdf_w = ysm1_brdf.pdf(yz);
 		if(n > rr_threshold){
-			pdf_w *= rr_probability(ysm1.brdf().f(yz), yz.abs_cos(), pdf_w);
+			pdf_w *= rr_probability(ysm1_brdf.f(yz), yz.abs_cos(), pdf_w);
 		}
 
 		//convert to area measure
-		const float J = zy.abs_cos() / squared_norm(ztm1_isect.p() - ysm1_isect.p());
+		const float J = zy.abs_cos() / squared_norm(ztm1.p() - ysm1.p());
 		pdf_A = pdf_w * J;
 
 		//calculate FG
-		FG = ysm1.brdf().f(yz) * yz.abs_cos() * J;
+		FG = ysm1_brdf.f(yz) * yz.abs_cos() * J;
 	}
 	return std::make_tuple(pdf_A, FG);
 }
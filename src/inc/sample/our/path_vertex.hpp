@@ -5,6 +5,7 @@
 #define OUR_PATH_VERTEX_HPP
 
 #include<array>
+#include<tuple>
 #include"../../base.hpp"
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -24,6 +25,25 @@ class cache;
 //number of nearest cache points (Nc in Sec 5.2)
 static const size_t Nc = 3;
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//path vertex layout
+/*/////////////////////////////////////////////////////////////////////////////////////////////////
+path vertices are stored compactly so that many of them stay in cache during MIS evaluation
+- normal is encoded by octahedral mapping into 32 bits (see encode_oct)
+- brdf is not stored but made from material on demand (brdf() of each vertex)
+- incident/outgoing directions are not stored but recalculated from positions of neighbor vertices (see calc_directions)
+- neighbor cache points are stored as 32-bit indices of cache_index (light_path/camera_path::neighbor_cache returns cache point)
+/////////////////////////////////////////////////////////////////////////////////////////////////*/
+
+//return direction from x1 to x2 (w.r.t. normal at x1), direction from x2 to x1 (w.r.t. normal at x2) and squared distance
+inline std::tuple<direction, direction, float> calc_directions(const ::intersection &x1, const ::intersection &x2)
+{
+	const vec3 tmp_w = x2.p() - x1.p();
+	const float dist2 = squared_norm(tmp_w);
+	const vec3 w = tmp_w / sqrt(dist2);
+	return std::make_tuple(direction(w, x1.n()), direction(-w, x2.n()), dist2);
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 //light_path_vertex
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -32,26 +52,26 @@ class light_path_vertex
 {
 public:
 
-	//isect: intersection point, brdf: BRDF at isect, wi/wo: incident/outgoing directions, Le_throughput: emittance Le*throughput_weight
-	light_path_vertex(const intersection &isect, const brdf &brdf, const direction &wi, const direction &wo, const col3 &Le_throughput, const float pdf) : m_brdf(brdf), m_isect(isect), m_wi(wi), m_wo(wo), m_Le_throughput(Le_throughput), m_pdf_fwd(pdf)
+	//isect: intersection point, Le_throughput: emittance Le*throughput_weight, pdf: pdf in forward direction (from light source)
+	light_path_vertex(const ::intersection &isect, const col3 &Le_throughput, const float pdf) : m_p(isect.p()), m_n(encode_oct(isect.n())), mp_mtl(&isect.material()), m_Le_throughput(Le_throughput), m_pdf_fwd(pdf)
 	{
 		for(size_t i = 0; i < Nc; i++){
-			m_cache_ptrs[i] = nullptr; m_Le_throughput_FGVc[i] = -1;
+			m_cache_indices[i] = uint32_t(-1); m_Le_throughput_FGVc[i] = -1;
 		}
 		m_pdf_bwd = -1;
 		m_pdf_bwd_rr = -1;
 	}
 
-	//set cache point c
-	void set_neighbor_cache(const size_t i, const cache &c)
+	//set index of i-th nearest cache point
+	void set_neighbor_cache(const size_t i, const uint32_t idx)
 	{
-		m_cache_ptrs[i] = &c;
+		m_cache_indices[i] = idx;
 	}
 
-	//return i-th nearest cache point
-	const cache &neighbor_cache(const size_t i) const
+	//return index of i-th nearest cache point
+	uint32_t neighbor_cache_index(const size_t i) const
 	{
-		return assert(m_cache_ptrs[i] != nullptr), *m_cache_ptrs[i];
+		return assert(m_cache_indices[i] != uint32_t(-1)), m_cache_indices[i];
 	}
 
 	//set q*/p at i-th cache point  (q* in Eq. (15))
@@ -96,37 +116,38 @@ public:
 		return assert(m_pdf_bwd_rr != -1), m_pdf_bwd_rr;
 	}
 
-	const direction &wi() const
+	::brdf brdf() const
 	{
-		return m_wi;
+		const ::intersection isect = intersection();
+		return isect.material().make_brdf(isect, direction());
 	}
-	const direction &wo() const
+
+	::intersection intersection() const
 	{
-		return m_wo;
+		return ::intersection(m_p, decode_oct(m_n), mp_mtl);
 	}
 
-	const brdf &brdf() const
+	//return position/material without decoding normal
+	const vec3 &p() const
 	{
-		return m_brdf;
+		return m_p;
 	}
-
-	const intersection &intersection() const
+	const ::material &material() const
 	{
-		return m_isect;
+		return *mp_mtl;
 	}
 
 private:
 
-	::brdf         m_brdf;
-	::intersection m_isect;
-	direction      m_wi;
-	direction      m_wo;
-	col3           m_Le_throughput;
-	float          m_Le_throughput_FGVc[Nc];
-	float          m_pdf_fwd;
-	float          m_pdf_bwd;
-	float          m_pdf_bwd_rr;
-	const cache   *m_cache_ptrs[Nc];
+	vec3              m_p;
+	uint32_t          m_n; //normal encoded by encode_oct
+	const ::material *mp_mtl;
+	col3              m_Le_throughput;
+	float             m_Le_throughput_FGVc[Nc];
+	float             m_pdf_fwd;
+	float             m_pdf_bwd;
+	float             m_pdf_bwd_rr;
+	uint32_t          m_cache_indices[Nc];
 };
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -137,28 +158,28 @@ class camera_path_vertex
 {
 public:
 
-	//isect: intersection point, brdf: brdf at isect, wo&wi outgoing&incident directions, throughput_We: throughput * importance / PDF,
-	camera_path_vertex(const intersection &isect, const brdf &brdf, const direction &wo, const direction &wi, const col3 &throughput_We, const float pdf) : m_brdf(brdf), m_isect(isect), m_wo(wo), m_wi(wi), m_throughput_We(throughput_We), m_pdf_fwd(pdf)
+	//isect: intersection point, throughput_We: throughput * importance / PDF, pdf: pdf in forward direction (from eye)
+	camera_path_vertex(const ::intersection &isect, const col3 &throughput_We, const float pdf) : m_p(isect.p()), m_n(encode_oct(isect.n())), mp_mtl(&isect.material()), m_throughput_We(throughput_We), m_pdf_fwd(pdf)
 	{
-		//initialize m_cache_ptrs & m_FGVc
+		//initialize m_cache_indices & m_FGVc
 		for(size_t i = 0; i < Nc; i++){
-			m_cache_ptrs[i] = nullptr; m_FGVc[i][0] = -1;
+			m_cache_indices[i] = uint32_t(-1); m_FGVc[i][0] = -1;
 		}
 		m_FG_bwd[0] = -1;
 		m_pdf_bwd = -1;
 		m_pdf_bwd_rr = -1; //pdf including russian roulette probability
 	}
 
-	//set cache point c
-	void set_neighbor_cache(const size_t i, const cache &c)
+	//set index of i-th nearest cache point
+	void set_neighbor_cache(const size_t i, const uint32_t idx)
 	{
-		m_cache_ptrs[i] = &c;
+		m_cache_indices[i] = idx;
 	}
 
-	//return i-th nearest cache point
-	const cache &neighbor_cache(const size_t i) const
+	//return index of i-th nearest cache point
+	uint32_t neighbor_cache_index(const size_t i) const
 	{
-		return assert(m_cache_ptrs[i] != nullptr), *m_cache_ptrs[i];
+		return assert(m_cache_indices[i] != uint32_t(-1)), m_cache_indices[i];
 	}
 
 	//return F(brdf) x G(geo term) x V(visibility) stored at cache points
@@ -210,37 +231,39 @@ public:
 		return assert(m_pdf_bwd_rr != -1), m_pdf_bwd_rr;
 	}
 
-	const direction &wi() const
+	//brdf of vertex on lens must not be used (material stores camera)
+	::brdf brdf() const
 	{
-		return m_wi;
+		const ::intersection isect = intersection();
+		return isect.material().make_brdf(isect, direction());
 	}
-	const direction &wo() const
+
+	::intersection intersection() const
 	{
-		return m_wo;
+		return ::intersection(m_p, decode_oct(m_n), mp_mtl);
 	}
 
-	const brdf &brdf() const
+	//return position/material without decoding normal
+	const vec3 &p() const
 	{
-		return m_brdf;
+		return m_p;
 	}
-
-	const intersection &intersection() const
+	const ::material &material() const
 	{
-		return m_isect;
+		return *mp_mtl;
 	}
 
 private:
 
-	::brdf               m_brdf;
-	::intersection       m_isect;
-	direction            m_wo;
-	direction            m_wi;
+	vec3                 m_p;
+	uint32_t             m_n; //normal encoded by encode_oct
+	const ::material    *mp_mtl;
 	col3                 m_FG_bwd;
 	col3                 m_throughput_We;
 	float                m_pdf_fwd;
 	float                m_pdf_bwd;
 	float                m_pdf_bwd_rr;
-	const cache         *m_cache_ptrs[Nc];
+	uint32_t             m_cache_indices[Nc];
 	std::array<col3, Nc> m_FGVc;
 };
 
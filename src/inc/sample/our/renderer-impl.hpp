@@ -8,37 +8,56 @@ namespace our{
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
 
-//constructor (M : number of pre-sampled light sub-paths, nt : number of threads)
-inline renderer::renderer(const scene &scene, const camera &camera, const size_t M, const size_t nt) : m_M(M), m_nt(nt), m_sum(), m_ite()
+//constructor (M : number of pre-sampled light sub-paths, nt : number of threads, tile_size(_for_gen_caches) : size of tiles, seed : seed of random numbers, num_light_paths : number of light sub-paths)
+inline renderer::renderer(const scene &scene, const camera &camera, const size_t M, const size_t nt, const int tile_size, const int tile_size_for_gen_caches, const uint64_t seed, const size_t num_light_paths) : m_M(M), m_nt(nt), m_pool(nt), m_tile_size(tile_size), m_tile_size_for_gen_caches(tile_size_for_gen_caches), m_seed(seed), m_sum(), m_ite(), m_memo_stats(), m_phase_times()
 {
-	//number of samples for strategies (s>=1, t=1)
-	m_ns1 = camera.res_x() * camera.res_y();
+	//number of samples for strategies (s>=1, t=1) (i.e., number of light sub-paths, M of which are pre-sampled light sub-paths)
+	m_ns1 = std::max((num_light_paths == 0) ? size_t(camera.res_x()) * camera.res_y() : num_light_paths, M);
 
 	//buffer to store contributions of strategies (s>=1, t=1)
-	m_buf_s1 = imagef(camera.res_x(), camera.res_y());
+	m_buf_s1 = splat_buffer(camera.res_x(), camera.res_y(), m_pool.num_threads());
 
-	//spinlock
-	m_locks = std::make_unique<spinlock[]>(camera.res_x() * camera.res_y());
+	//buffers to collect cache points in each thread
+	m_cache_buffers.resize(m_pool.num_threads());
+
+	//arenas of vertices of light sub-paths generated by each thread
+	m_light_path_arenas.resize(m_pool.num_threads());
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
-//rendering
+//rendering (return image of current iteration)
 inline imagef renderer::render(const scene &scene, const camera &camera)
+{
+	imagef screen(camera.res_x(), camera.res_y());
+	render_into(scene, camera, screen);
+	return screen;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+//rendering (add image of current iteration to accum)
+template<class T> inline void renderer::render_into(const scene &scene, const camera &camera, Image<T> &accum)
 {
 	m_ite += 1;
 
 	const int w = camera.res_x();
 	const int h = camera.res_y();
-	imagef screen(w, h);
+	assert((accum.width() == w) && (accum.height() == h));
+
+	//wall time of each phase
+	auto t = std::chrono::steady_clock::now();
+	auto lap = [&](double &sec){
+		const auto now = std::chrono::steady_clock::now();
+		sec += std::chrono::duration<double>(now - t).count(); t = now;
+	};
 
 	//generate cache points (Line 3 of Algorithm1)
 	{
-		std::mutex mtx;
-		std::vector<cache> caches;
-		auto locked_add = [&](const camera_path_vertex &v){
-			std::lock_guard<std::mutex> lock(mtx); caches.emplace_back(v, m_ite == 1);
-		};
+		//cache points are appended to buffer of each thread without locks
+		for(auto &buf : m_cache_buffers){
+			buf.clear();
+		}
 
 		//camera setup for generating cache points
 		//generate eye sub-paths from camera_for_gen_caches (with approximately wxhx0.4% pixels)
@@ -48,11 +67,12 @@ inline imagef renderer::render(const scene &scene, const camera &camera)
 		const ::camera camera_for_gen_caches(camera.p(), camera.p() + camera.d(), res_x, res_y, camera.fovy(), camera.lens_radius());
 
 		//cache points are generated by tracing eye sub-paths. Each vertex of the eye sub-paths are used as the cache point
-		std::atomic_size_t idx(0);
-		in_parallel(res_x, res_y, [&](const int x, const int y)
+		m_cache_runs.resize(res_x * res_y);
+		in_parallel(res_x, res_y, m_tile_size_for_gen_caches, [&](const int x, const int y)
 		{
-			thread_local random_number_generator rng(std::random_device{}());
+			random_number_generator rng(m_seed, rng_stream(0, x + res_x * y), sample_index());
 			thread_local camera_path z;
+			scene.reset_last_occluder();
 
 			if(m_ite == 1){
                 //for 1st iteration, estimate normalization factor Q using pre-sampled light sub-paths of 1st iteration
@@ -61,25 +81,72 @@ inline imagef renderer::render(const scene &scene, const camera &camera)
                 //estimate normalization factor Q using cache points at previous iteration (m_caches)
 				z.construct(scene, camera_for_gen_caches, x, y, rng, m_caches);
 			}
+			const size_t tid = thread_pool::thread_index();
+			auto &buf = m_cache_buffers[tid];
+			m_cache_runs[x + res_x * y] = cache_run{ uint32_t(tid), uint32_t(buf.size()), uint32_t(z.num_vertices() - 1) };
 			for(size_t j = 1, n = z.num_vertices(); j < n; j++){
-				locked_add(std::move(std::move(z(j)))); //generation of cache points for current iteration
+				buf.emplace_back(z, j, m_ite == 1); //generation of cache points for current iteration
 			}
-		}, m_nt);
+		}, m_pool);
+
+		//concatenate runs of cache points in order of pixels (offset of each run is prefix sum of counts),
+		//so that the order of cache points does not depend on threads
+		size_t num_caches = 0;
+		for(const auto &run : m_cache_runs){
+			num_caches += run.count;
+		}
+		std::vector<cache> caches;
+		caches.reserve(num_caches);
+		for(const auto &run : m_cache_runs){
+			auto first = m_cache_buffers[run.tid].begin() + run.first;
+			caches.insert(caches.end(), std::make_move_iterator(first), std::make_move_iterator(first + run.count));
+		}
 
-		//construct kd-tree to search cache points
-		m_caches = kd_tree<cache>(std::move(caches), [](const cache &c) -> const vec3&{
-			return c.intersection().p();
-		});
+		//construct spatial index to search cache points (built in parallel)
+		m_caches = cache_index(std::move(caches), [](const cache &c){
+			return c.p();
+		}, m_pool);
 	}
+	lap(m_phase_times.gen_caches);
 
 	//generate light sub-paths
-	//we prepare wxh light sub-paths and each light sub-path is used for strategies other than resampling strategies.
-	m_light_paths.resize(w * h);
-	in_parallel(w * h, [&](const int idx)
+	//we prepare m_ns1 light sub-paths (independent of resolution) and each light sub-path is used for strategies other than resampling strategies.
+	//vertices are appended to arena of each thread without locks (capacity of arenas is reused over iterations)
+	for(auto &arena : m_light_path_arenas){
+		arena.clear();
+	}
+	m_light_paths.resize(m_ns1);
+	in_parallel(int(m_ns1), [&](const int idx)
 	{
-		thread_local random_number_generator rng(std::random_device{}());
-		m_light_paths[idx].construct(scene, rng, m_caches);
-	}, m_nt);
+		random_number_generator rng(m_seed, rng_stream(1, idx), sample_index());
+		scene.reset_last_occluder();
+		m_light_paths[idx].construct(scene, rng, m_caches, m_light_path_arenas[thread_pool::thread_index()], false);
+	}, m_pool);
+
+	//search neighbor cache points of all vertices at once (queries are answered in order of morton codes)
+	{
+		m_query_offsets.resize(m_ns1 + 1);
+		m_query_offsets[0] = 0;
+		for(size_t i = 0; i < m_ns1; i++){
+			m_query_offsets[i + 1] = m_query_offsets[i] + m_light_paths[i].num_queries();
+		}
+		m_query_points.resize(m_query_offsets[m_ns1]);
+		in_parallel(int(m_ns1), [&](const int idx)
+		{
+			const auto &y = m_light_paths[idx];
+			for(size_t i = 0, n = y.num_queries(); i < n; i++){
+				m_query_points[m_query_offsets[idx] + i] = y(i + 1).p();
+			}
+		}, m_pool);
+
+		m_caches.find_nearest<Nc>(m_query_points, m_neighbors, m_pool);
+
+		in_parallel(int(m_ns1), [&](const int idx)
+		{
+			scene.reset_last_occluder();
+			m_light_paths[idx].set_neighbor_caches(scene, m_neighbors.data() + m_query_offsets[idx]);
+		}, m_pool);
+	}
 
 	//generate ¥hat{Y}_n in Line 2 of Algorithm1
 	{
@@ -95,14 +162,25 @@ inline imagef renderer::render(const scene &scene, const camera &camera)
 				m_candidates[V++] = candidate(m_light_paths[i], j);
 			}
 		}
+		m_candidate_array = candidate_array(m_candidates);
 	}
+	lap(m_phase_times.gen_light_paths);
 
 	//construct resampling pmfs at cache points
-	in_parallel(int(m_caches.end() - m_caches.begin()), [&](const int idx)
 	{
-		const cache &c = *(m_caches.begin() + idx);
-		const_cast<cache&>(c).calc_distribution(scene, m_candidates, m_M);
-	}, m_nt);
+		const size_t num_caches = m_caches.end() - m_caches.begin();
+		std::atomic_size_t num_memo_hits(0);
+		in_parallel(int(num_caches), [&](const int idx)
+		{
+			const cache &c = *(m_caches.begin() + idx);
+			scene.reset_last_occluder();
+			num_memo_hits += const_cast<cache&>(c).calc_distribution(scene, m_candidate_array, m_M);
+		}, m_pool);
+
+		m_memo_stats.num_weights += num_caches * m_candidates.size();
+		m_memo_stats.num_memo_hits += num_memo_hits;
+	}
+	lap(m_phase_times.calc_distributions);
 
 	//calculate normalization factor for virtual cache point
 	{
@@ -110,31 +188,33 @@ inline imagef renderer::render(const scene &scene, const camera &camera)
 		m_Qp = float(m_sum / m_ite);
 	}
 
-	//initialize buffer that stores contributions of strategies (s>=1,t=1) of light tracing
-	memset(m_buf_s1(0,0), 0, sizeof(float) * 3 * w * h);
-
-	in_parallel(w, h, [&](const int x, const int y)
+	//pixels are scheduled tile by tile, so that each thread traces coherent eye sub-paths
+	in_parallel(w, h, m_tile_size, [&](const int x, const int y)
 	{
-		thread_local random_number_generator rng(std::random_device{}());
+		random_number_generator rng(m_seed, rng_stream(2, x + w * y), sample_index());
+		scene.reset_last_occluder();
 
 		const col3 col = radiance(x, y, scene, camera, rng);
-		if(!(isnan(col[0] + col[1] + col[2]))){
-			screen(x, y)[0] = col[0];
-			screen(x, y)[1] = col[1];
-			screen(x, y)[2] = col[2];
+		if(!(std::isnan(col[0] + col[1] + col[2]))){
+			accum(x, y)[0] += col[0];
+			accum(x, y)[1] += col[1];
+			accum(x, y)[2] += col[2];
 		}
-	}, m_nt);
+	}, m_pool);
+	lap(m_phase_times.radiance);
 
-	//add contributions of strategies (s>=1,t=1)
+	//add contributions of strategies (s>=1,t=1) (m_buf_s1 is reset to zero for next iteration)
 	const float inv_ns1 = 1 / float(m_ns1);
-	for(int y = 0; y < h; y++){
+	in_parallel(h, [&](const int y)
+	{
 		for(int x = 0; x < w; x++){
-			screen(x, y)[0] += m_buf_s1(x, y)[0] * inv_ns1;
-			screen(x, y)[1] += m_buf_s1(x, y)[1] * inv_ns1;
-			screen(x, y)[2] += m_buf_s1(x, y)[2] * inv_ns1;
+			const col3 col = m_buf_s1.take(x, y);
+			accum(x, y)[0] += col[0] * inv_ns1;
+			accum(x, y)[1] += col[1] * inv_ns1;
+			accum(x, y)[2] += col[2] * inv_ns1;
 		}
-	}
-	return screen;
+	}, m_pool);
+	lap(m_phase_times.splat);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -146,13 +226,19 @@ inline col3 renderer::radiance(const int x, const int y, const scene &scene, con
 
 	//generate eye sub-path
 	camera_path.construct(scene, camera, x, y, rng, m_caches);
-	const light_path &light_path = m_light_paths[x + camera.res_x() * y];
 
 	//calculate contributions of strategies (s>=1,t=1) and store them in m_buf_s1
-	calculate_s1(scene, camera, light_path, camera_path, rng);
+	//light sub-paths are distributed over pixels, so that each light sub-path is connected to the eye exactly once
+	//(one per pixel if m_ns1 = widthxheight, some pixels have none if fewer, and several if more)
+	const size_t num_pixels = size_t(camera.res_x()) * camera.res_y();
+	const size_t idx = x + size_t(camera.res_x()) * y;
+	for(size_t i = idx * m_ns1 / num_pixels, n = (idx + 1) * m_ns1 / num_pixels; i < n; i++){
+		calculate_s1(scene, camera, m_light_paths[i], camera_path, rng);
+	}
 
 	//calculate contributions of resampling strategies (s>=1,t>=2) and strategies (s=0,t>=2)
-	return calculate_0t(scene, light_path, camera_path) + calculate_st(scene, camera_path, rng);
+	//strategies (s=0,t>=2) only refer to y(-1) (storing scene), which is shared by all light sub-paths
+	return calculate_0t(scene, m_light_paths[idx % m_ns1], camera_path) + calculate_st(scene, camera_path, rng);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -164,15 +250,17 @@ inline col3 renderer::calculate_0t(const scene &scene, const light_path &y, cons
 	if(t >= 2){
 
 		const auto &ztm1 = z(t - 1);
-		const auto &ztm1_isect = z(t - 1).intersection();
+		const auto ztm1_isect = z(t - 1).intersection();
 
 		//if z(t-1) is on light source
 		if(ztm1_isect.material().is_emissive()){
 
-			const col3 Le = ztm1_isect.material().Le(ztm1_isect, ztm1.wo());
+			//outgoing direction toward z(t-2)
+			const direction ztm1_wo = std::get<1>(calc_directions(z(t - 2).intersection(), ztm1_isect));
+			const col3 Le = ztm1_isect.material().Le(ztm1_isect, ztm1_wo);
 
 			const float mis_weight = 1 / (
-				0 + 1 + camera_path::mis_partial_weight(scene, y, 0, z, t, direction(), ztm1.wi(), m_M, m_Qp)
+				0 + 1 + camera_path::mis_partial_weight(scene, y, 0, z, t, direction(), direction(ztm1_isect.n()), m_M, m_Qp, float(m_ns1))
 			);
 			return Le * ztm1.throughput_We() * mis_weight;
 		}
@@ -185,12 +273,13 @@ inline col3 renderer::calculate_0t(const scene &scene, const light_path &y, cons
 //calculate contributions of strategies (s>=1, t=1)
 inline void renderer::calculate_s1(const scene &scene, const camera &camera, const light_path &y, const camera_path &z, random_number_generator &rng)
 {
+	const auto &z0 = z(0);
+	const auto z0_isect = z(0).intersection();
+
 	for(size_t s = 1, nL = y.num_vertices(); s <= nL; s++){
 		
-		const auto &z0 = z(0);
 		const auto &ysm1 = y(s - 1);
-		const auto &z0_isect = z(0).intersection();
-		const auto &ysm1_isect = y(s - 1).intersection();
+		const auto ysm1_isect = y(s - 1).intersection();
 
 		const vec3 tmp_zy = ysm1_isect.p() - z0_isect.p();
 		const float dist2 = squared_norm(tmp_zy);
@@ -212,7 +301,7 @@ inline void renderer::calculate_s1(const scene &scene, const camera &camera, con
 			//visibility test
 			if(scene.intersect(ray(z0_isect.p(), zy, dist)) == false){
 
-				const col3 fyz = ysm1.brdf().f(yz);
+				const col3 fyz = ysm1_isect.material().make_brdf(ysm1_isect, yz).f(yz);
 				const float We = camera.We(zy);
 				const float G = yz.abs_cos() * zy.abs_cos() / dist2;
 
@@ -221,11 +310,8 @@ inline void renderer::calculate_s1(const scene &scene, const camera &camera, con
 				);
 				const col3 contrib = ysm1.Le_throughput() * fyz * (We * G / z0.pdf_fwd() * mis_weight);
 
-				//update m_buf_s1 using spinlock
-				std::lock_guard<spinlock> lock(m_locks[screen_pos.x + camera.res_x() * screen_pos.y]);
-				m_buf_s1(screen_pos.x, screen_pos.y)[0] += contrib[0];
-				m_buf_s1(screen_pos.x, screen_pos.y)[1] += contrib[1];
-				m_buf_s1(screen_pos.x, screen_pos.y)[2] += contrib[2];
+				//update m_buf_s1 without locks
+				m_buf_s1.add(screen_pos.x, screen_pos.y, contrib, thread_pool::thread_index());
 			}
 		}
 	}
@@ -242,13 +328,14 @@ inline col3 renderer::calculate_st(const scene &scene, const camera_path &z, ran
 	for(size_t t = 2; t <= nE; t++){
 
 		const auto &ztm1 = z(t - 1);
-		const auto &ztm1_isect = z(t - 1).intersection();
+		const auto ztm1_isect = z(t - 1).intersection();
 
 		if(ztm1_isect.material().is_emissive()){
 			continue;
 		}
 
 		//sample cache point uniformly (i.e, P_c(i)=1/(Nc+1) in Sec. 5.2)
+		rng.set_dimension(resampling_dimension + 4 * t);
 		size_t cache_idx = Nc;
 		float pmf = 1 / float(Nc + 1);
 		{
@@ -260,28 +347,25 @@ inline col3 renderer::calculate_st(const scene &scene, const camera_path &z, ran
 				u -= 1 / float(Nc + 1);
 			}
 		}
-		if((cache_idx != Nc) && (ztm1.neighbor_cache(cache_idx).normalization_constant() == 0)){
+		if((cache_idx != Nc) && (z.neighbor_cache(t - 1, cache_idx).normalization_constant() == 0)){
 			continue;
 		}
 
 		//resample light sub-path  (Line13 in Algorithm1)
 		size_t sample_idx;
-		const candidate *p_candidate;
 		if(cache_idx != Nc){
-			const auto sample = ztm1.neighbor_cache(cache_idx).sample(rng);
-			sample_idx = sample.p_elem - &*ztm1.neighbor_cache(cache_idx).begin();
-			p_candidate = sample.p_elem;
+			const auto sample = z.neighbor_cache(t - 1, cache_idx).sample(rng);
+			sample_idx = sample.idx;
 			pmf *= sample.pmf;
 		}else{
 		    //use virtual cache point
 			sample_idx = rng.generate_uniform_int(0, m_candidates.size() - 1);
-			p_candidate = &m_candidates[sample_idx];
 			pmf *= 1 / float(m_candidates.size());
 		}
-		const auto &y = p_candidate->path();
-		const auto  s = p_candidate->s();
+		const auto &y = m_candidates[sample_idx].path();
+		const auto  s = m_candidates[sample_idx].s();
 		const auto &ysm1 = y(s - 1);
-		const auto &ysm1_isect = y(s - 1).intersection();
+		const auto ysm1_isect = y(s - 1).intersection();
 
 		const vec3 tmp_yz = ztm1_isect.p() - ysm1_isect.p();
 		const float dist2 = squared_norm(tmp_yz);
@@ -299,8 +383,8 @@ inline col3 renderer::calculate_st(const scene &scene, const camera_path &z, ran
 		//visibility test between y(s-1) & z(t-1)
 		if(scene.intersect(ray(ysm1_isect.p(), yz, dist)) == false){
 
-			const col3 fyz = ysm1.brdf().f(yz);
-			const col3 fzy = ztm1.brdf().f(zy);
+			const col3 fyz = ysm1_isect.material().make_brdf(ysm1_isect, yz).f(yz);
+			const col3 fzy = ztm1_isect.material().make_brdf(ztm1_isect, zy).f(zy);
 			const float G = yz.abs_cos() * zy.abs_cos() / dist2;
 
 			//calculate resampling-aware weighting function
@@ -309,10 +393,11 @@ inline col3 renderer::calculate_st(const scene &scene, const camera_path &z, ran
 				float val, sum_val = 0;
 				for(size_t i = 0; i < Nc; i++){
 				    //normalization factor Q at nearest cache point
-					const float Q = ztm1.neighbor_cache(i).Q();
+					const cache &c = z.neighbor_cache(t - 1, i);
+					const float Q = c.Q();
 
 					//calculate q*/p
-					const float Le_throughput_FGVc = ztm1.neighbor_cache(i).pmf(sample_idx) * ztm1.neighbor_cache(i).normalization_constant();
+					const float Le_throughput_FGVc = c.pmf(sample_idx) * c.normalization_constant();
 				
 					if(Le_throughput_FGVc > 0){
 						const float tmp_val = (1 / float(Nc + 1)) * m_M / (
@@ -333,7 +418,7 @@ inline col3 renderer::calculate_st(const scene &scene, const camera_path &z, ran
 				sum_val += tmp_val;
 				
 				mis_weight = val / (
-					light_path::mis_partial_weight(y, s, z, t, yz, zy, m_M, m_Qp) + sum_val + camera_path::mis_partial_weight(scene, y, s, z, t, yz, zy, m_M, m_Qp)
+					light_path::mis_partial_weight(y, s, z, t, yz, zy, m_M, m_Qp) + sum_val + camera_path::mis_partial_weight(scene, y, s, z, t, yz, zy, m_M, m_Qp, float(m_ns1))
 				);
 			}
 
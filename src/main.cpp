@@ -54,18 +54,28 @@ int main(int argc, char **argv)
 
 		std::cout << "iteration = " << n << std::endl;
 
-		const imagef result = renderer.render(scene, camera);
+		renderer.render_into(scene, camera, sum);
+	}
+
+	//report hit rate of visibility tests, reuse rate of q*/p and time of each phase
+	{
+		const auto stats = scene.calc_occlusion_stats();
+		std::cout << "visibility tests = " << stats.num_rays;
+		std::cout << ", occluded = " << 100.0 * stats.num_occluded / std::max<size_t>(stats.num_rays, 1) << "%";
+		std::cout << ", last occluder hits = " << 100.0 * stats.num_last_occluder_hits / std::max<size_t>(stats.num_occluded, 1) << "% of occluded" << std::endl;
 
-		for(int i = 0, npixel = 3 * w * h; i < npixel; i++){
-			sum(0,0)[i] += result(0,0)[i];
-		}
+		const auto memo_stats = renderer.calc_memo_stats();
+		std::cout << "q*/p of cache points = " << memo_stats.num_weights;
+		std::cout << ", reused from light sub-paths = " << 100.0 * memo_stats.num_memo_hits / std::max<size_t>(memo_stats.num_weights, 1) << "%" << std::endl;
+
+		const auto times = renderer.calc_phase_times();
+		std::cout << "time [s]: cache points = " << times.gen_caches << ", light sub-paths = " << times.gen_light_paths;
+		std::cout << ", resampling pmfs = " << times.calc_distributions << ", radiance = " << times.radiance << ", light tracing splats = " << times.splat << std::endl;
 	}
 
 	//save image as test.bmp
 	image result(w, h);
-	for(int i = 0, n = 3 * w * h; i < n; i++){
-		result(0,0)[i] = (unsigned char) (clamp(pow(float(sum(0,0)[i] / max_iterations ), 1.0f / 2.2f), 0, 1) * 255 ); //gamma_correction
-	}
+	tonemap(2.2f)(sum, double(max_iterations), result, renderer.pool()); //gamma_correction
 	save_as_bmp(result, "test.bmp");
 	return 0;
 }